@@ -0,0 +1,538 @@
+/*
+  Bit-level simulator for the AltSoftSerial timer ISRs.
+
+  AltSoftSerial.cpp is compiled unchanged against a simulated Timer1 (16-bit counter, input capture
+  unit, compare A/B) running at 16MHz like the Uno. The simulator decides when each interrupt would
+  be serviced, taking into account the cost of the AltSoftSerial ISRs themselves and a competing
+  interrupt load (millis(), debug Serial, motor PWM / encoder ISRs). Edges on the receive pin are
+  jittered, and the transmit pin is decoded by an ideal UART.
+
+  Reports bit-error rate against baud rate and ticks_per_bit for each load, whether timing_error
+  flagged the failures, and the highest baud rate that ran without errors.
+
+  Build (from the repository root):
+    g++ -std=c++17 -O2 -DARDUINO=100 -I HostSim/include -I libraries/AltSoftSerial \
+        HostSim/AltSoftSerialSim/AltSoftSerialSim.cpp -o altss_sim
+  Run:
+    ./altss_sim [bytesPerRun] [edgeJitterPercent] [seed]
+*/
+
+#include <Arduino.h>
+
+// Compiled here rather than linked so the ISRs and their static state are reachable
+#include "AltSoftSerial.cpp"
+
+#include <stdio.h>
+#include <vector>
+#include <random>
+
+
+/************************************************************************************************************************/
+/************************/
+/*   Simulated Timer1   */
+/************************/
+/************************************************************************************************************************/
+
+volatile uint8_t SREG;
+volatile uint8_t TCCR1A;
+volatile uint8_t TCCR1B;
+volatile uint8_t TIMSK1;
+SimFlagRegister TIFR1;
+volatile uint16_t ICR1;
+volatile uint16_t OCR1A;
+volatile uint16_t OCR1B;
+
+// Approximate avr-gcc cycle counts. Entry covers interrupt response, the vector jump and the
+// register pushes before the ISR first reads the timer.
+#define ISR_ENTRY_CYCLES        24
+#define CAPTURE_ISR_CYCLES      140
+#define COMPARE_A_ISR_CYCLES    120
+#define COMPARE_B_ISR_CYCLES    100
+
+// ATmega328P vector numbers, lower number wins when several are pending
+#define VECTOR_TIMER1_CAPT      10
+#define VECTOR_TIMER1_COMPA     11
+#define VECTOR_TIMER1_COMPB     12
+
+#define NEVER                   UINT64_MAX
+
+struct Edge {
+  uint64_t t;
+  uint8_t level;
+};
+
+/*
+  A competing interrupt source. Once an ISR is running nothing else is serviced (AVR ISRs
+  do not nest), so a long ISR delays AltSoftSerial regardless of its vector number.
+*/
+struct LoadSource {
+  const char *name;
+  uint8_t vector;
+  uint32_t period;    // cycles between triggers
+  uint32_t duration;  // cycles spent in the ISR
+  uint32_t jitter;    // random extra delay (cycles) added to each period
+};
+
+struct LoadProfile {
+  const char *name;
+  std::vector<LoadSource> sources;
+};
+
+struct RunResult {
+  uint32_t bytes;
+  uint32_t bitErrors;
+  uint32_t byteErrors;
+  uint32_t timingErrors;
+  uint64_t maxCaptureLatency;
+};
+
+AltSoftSerial altser;
+
+class Timer1Sim {
+  public:
+    uint64_t now = 0;
+    uint64_t readClock = 0;
+    uint64_t cpuFreeAt = 0;
+    uint64_t captureFlagAt = 0;
+    uint64_t maxCaptureLatency = 0;
+    uint64_t searchA = 0;
+    uint64_t searchB = 0;
+    uint16_t shadowA = 0;
+    uint16_t shadowB = 0;
+    uint8_t txLevel = 1;
+    std::vector<Edge> txEdges;
+
+    std::vector<LoadSource> loads;
+    std::vector<uint64_t> loadNext;
+    std::vector<bool> loadPending;
+    std::mt19937 rng;
+
+    uint32_t prescale() const {
+      if (TCCR1B & (1 << CS10)) return 1;
+      if (TCCR1B & (1 << CS11)) return 8;
+      return 256;
+    }
+
+    uint16_t tickAt(uint64_t t) const {
+      return (uint16_t)(t / prescale());
+    }
+
+    // Next time strictly after 'from' at which the counter equals 'value'
+    uint64_t nextMatch(uint16_t value, uint64_t from) const {
+      uint64_t p = prescale();
+      uint64_t tick = from / p + 1;
+      return (tick + (uint16_t)(value - (uint16_t)tick)) * p;
+    }
+
+    void reset(const LoadProfile &profile, uint32_t seed) {
+      now = readClock = cpuFreeAt = 0;
+      captureFlagAt = maxCaptureLatency = 0;
+      searchA = searchB = 0;
+      txLevel = 1;
+      txEdges.clear();
+      TCCR1A = TCCR1B = TIMSK1 = 0;
+      TIFR1.flags = 0;
+      ICR1 = OCR1A = OCR1B = 0;
+      shadowA = shadowB = 0;
+      rng.seed(seed);
+      loads = profile.sources;
+      loadNext.assign(loads.size(), 0);
+      loadPending.assign(loads.size(), false);
+      for (size_t i = 0; i < loads.size(); i++) {
+        loadNext[i] = rng() % loads[i].period;
+      }
+    }
+
+    // Restart compare matching from the time a compare register was rewritten
+    void noteCompareWrites(uint64_t t) {
+      if (OCR1A != shadowA) {
+        shadowA = OCR1A;
+        searchA = t;
+      }
+      if (OCR1B != shadowB) {
+        shadowB = OCR1B;
+        searchB = t;
+      }
+    }
+
+    void onInputEdge(const Edge &e) {
+      bool risingConfigured = TCCR1B & (1 << ICES1);
+      if ((e.level != 0) == risingConfigured) {
+        ICR1 = tickAt(e.t);
+        TIFR1.flags |= (1 << ICF1);
+        captureFlagAt = e.t;
+      }
+    }
+
+    void onCompareA(uint64_t t) {
+      searchA = t;
+      TIFR1.flags |= (1 << OCF1A);
+      uint8_t mode = (TCCR1A >> COM1A0) & 0x03;
+      uint8_t level = txLevel;
+      if (mode == 1) level = !txLevel;
+      if (mode == 2) level = 0;
+      if (mode == 3) level = 1;
+      if (level != txLevel) {
+        txLevel = level;
+        txEdges.push_back({t, level});
+      }
+    }
+
+    void onCompareB(uint64_t t) {
+      searchB = t;
+      TIFR1.flags |= (1 << OCF1B);
+    }
+
+    uint64_t compareATime() const {
+      bool active = (TIMSK1 & (1 << OCIE1A)) || (TCCR1A & ((1 << COM1A1) | (1 << COM1A0)));
+      return active ? nextMatch(OCR1A, searchA) : NEVER;
+    }
+
+    uint64_t compareBTime() const {
+      return (TIMSK1 & (1 << OCIE1B)) ? nextMatch(OCR1B, searchB) : NEVER;
+    }
+
+    bool anyPending() const {
+      if ((TIFR1.flags & TIMSK1) & ((1 << ICF1) | (1 << OCF1A) | (1 << OCF1B))) return true;
+      for (size_t i = 0; i < loads.size(); i++) {
+        if (loadPending[i]) return true;
+      }
+      return false;
+    }
+
+    /*
+      Service the highest priority pending interrupt at time s
+    */
+    void dispatch(uint64_t s) {
+      uint8_t bestVector = 0xFF;
+      int bestLoad = -1;
+      uint8_t enabled = TIFR1.flags & TIMSK1;
+
+      if (enabled & (1 << ICF1))       bestVector = VECTOR_TIMER1_CAPT;
+      else if (enabled & (1 << OCF1A)) bestVector = VECTOR_TIMER1_COMPA;
+      else if (enabled & (1 << OCF1B)) bestVector = VECTOR_TIMER1_COMPB;
+
+      for (size_t i = 0; i < loads.size(); i++) {
+        if (loadPending[i] && loads[i].vector < bestVector) {
+          bestVector = loads[i].vector;
+          bestLoad = i;
+        }
+      }
+
+      readClock = s + ISR_ENTRY_CYCLES;
+      if (bestLoad >= 0) {
+        loadPending[bestLoad] = false;
+        cpuFreeAt = s + loads[bestLoad].duration;
+      } else if (bestVector == VECTOR_TIMER1_CAPT) {
+        TIFR1.flags &= ~(1 << ICF1);
+        if (s - captureFlagAt > maxCaptureLatency) {
+          maxCaptureLatency = s - captureFlagAt;
+        }
+        TIMER1_CAPT_vect();
+        cpuFreeAt = s + CAPTURE_ISR_CYCLES;
+      } else if (bestVector == VECTOR_TIMER1_COMPA) {
+        TIFR1.flags &= ~(1 << OCF1A);
+        TIMER1_COMPA_vect();
+        cpuFreeAt = s + COMPARE_A_ISR_CYCLES;
+      } else {
+        TIFR1.flags &= ~(1 << OCF1B);
+        TIMER1_COMPB_vect();
+        cpuFreeAt = s + COMPARE_B_ISR_CYCLES;
+      }
+      noteCompareWrites(readClock);
+      readClock = now = s;
+    }
+
+    /*
+      Advances the simulation to the next event, or returns false if there is nothing left before 'until'
+    */
+    bool step(const std::vector<Edge> &input, size_t &inputIndex, uint64_t until) {
+      uint64_t tEdge = inputIndex < input.size() ? input[inputIndex].t : NEVER;
+      uint64_t tA = compareATime();
+      uint64_t tB = compareBTime();
+      uint64_t tLoad = NEVER;
+      size_t nextLoad = 0;
+      for (size_t i = 0; i < loads.size(); i++) {
+        if (loadNext[i] < tLoad) {
+          tLoad = loadNext[i];
+          nextLoad = i;
+        }
+      }
+      uint64_t tDispatch = anyPending() ? (cpuFreeAt > now ? cpuFreeAt : now) : NEVER;
+
+      uint64_t t = tEdge;
+      if (tA < t) t = tA;
+      if (tB < t) t = tB;
+      if (tLoad < t) t = tLoad;
+      if (tDispatch < t) t = tDispatch;
+      if (t == NEVER || t > until) {
+        return false;
+      }
+      now = readClock = t;
+
+      // hardware events first, then the CPU
+      if (t == tEdge) {
+        onInputEdge(input[inputIndex++]);
+      } else if (t == tA) {
+        onCompareA(t);
+      } else if (t == tB) {
+        onCompareB(t);
+      } else if (t == tLoad) {
+        loadPending[nextLoad] = true;
+        loadNext[nextLoad] = t + loads[nextLoad].period + (loads[nextLoad].jitter ? rng() % loads[nextLoad].jitter : 0);
+      } else {
+        dispatch(t);
+      }
+      return true;
+    }
+};
+
+Timer1Sim sim;
+
+uint16_t simTimer1Count() {
+  return sim.tickAt(sim.readClock);
+}
+
+
+/************************************************************************************************************************/
+/************************/
+/*   Line model         */
+/************************/
+/************************************************************************************************************************/
+
+/*
+  Generates the waveform of an ideal 8N1 transmitter with per-edge jitter.
+  Gaps between bytes are 0 to maxIdleBits bit times so back-to-back bytes are covered.
+*/
+std::vector<Edge> makeWaveform(const std::vector<uint8_t> &bytes, double cyclesPerBit, double jitterCycles,
+                               uint32_t maxIdleBits, uint64_t startAt, std::mt19937 &rng) {
+  std::vector<Edge> edges;
+  std::uniform_real_distribution<double> jitter(-jitterCycles, jitterCycles);
+  double t = (double)startAt;
+  uint8_t level = 1;
+
+  for (size_t n = 0; n < bytes.size(); n++) {
+    t += cyclesPerBit * (rng() % (maxIdleBits + 1));
+    for (int bit = 0; bit < 10; bit++) {
+      uint8_t b;
+      if (bit == 0)      b = 0;
+      else if (bit == 9) b = 1;
+      else               b = (bytes[n] >> (bit - 1)) & 1;
+
+      if (b != level) {
+        double when = t + bit * cyclesPerBit + jitter(rng);
+        uint64_t at = when < 0 ? 0 : (uint64_t)when;
+        if (!edges.empty() && at <= edges.back().t) {
+          at = edges.back().t + 1;
+        }
+        edges.push_back({at, b});
+        level = b;
+      }
+    }
+    t += 10 * cyclesPerBit;
+  }
+  return edges;
+}
+
+uint8_t levelAt(const std::vector<Edge> &edges, uint64_t t) {
+  uint8_t level = 1;
+  size_t lo = 0, hi = edges.size();
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (edges[mid].t <= t) lo = mid + 1;
+    else hi = mid;
+  }
+  if (lo > 0) level = edges[lo - 1].level;
+  return level;
+}
+
+/*
+  Ideal UART receiver: finds each start bit and samples the middle of every bit
+*/
+std::vector<uint8_t> decodeWaveform(const std::vector<Edge> &edges, double cyclesPerBit) {
+  std::vector<uint8_t> bytes;
+  uint64_t idleFrom = 0;
+
+  for (size_t i = 0; i < edges.size(); i++) {
+    if (edges[i].level != 0 || edges[i].t < idleFrom) {
+      continue;
+    }
+    uint64_t start = edges[i].t;
+    uint8_t value = 0;
+    for (int bit = 0; bit < 8; bit++) {
+      value |= levelAt(edges, start + (uint64_t)(cyclesPerBit * (1.5 + bit))) << bit;
+    }
+    bytes.push_back(value);
+    idleFrom = start + (uint64_t)(cyclesPerBit * 9.5);
+  }
+  return bytes;
+}
+
+/*
+  Counts bit errors between what was sent and what arrived. A dropped or inserted byte
+  costs 8 bit errors and the comparison resynchronises instead of failing every byte after it.
+*/
+void countErrors(const std::vector<uint8_t> &sent, const std::vector<uint8_t> &got, RunResult &r) {
+  size_t i = 0, j = 0;
+  while (i < sent.size() && j < got.size()) {
+    if (sent[i] == got[j]) {
+      i++;
+      j++;
+    } else if (i + 1 < sent.size() && sent[i + 1] == got[j]) {
+      r.bitErrors += 8;
+      r.byteErrors++;
+      i++;
+    } else if (j + 1 < got.size() && sent[i] == got[j + 1]) {
+      r.bitErrors += 8;
+      r.byteErrors++;
+      j++;
+    } else {
+      r.bitErrors += __builtin_popcount(sent[i] ^ got[j]);
+      r.byteErrors++;
+      i++;
+      j++;
+    }
+  }
+  r.bitErrors += 8 * ((sent.size() - i) + (got.size() - j));
+  r.byteErrors += (sent.size() - i) + (got.size() - j);
+}
+
+
+/************************************************************************************************************************/
+/************************/
+/*   Runs               */
+/************************/
+/************************************************************************************************************************/
+
+void startRun(const LoadProfile &profile, uint32_t baud, uint32_t seed) {
+  sim.reset(profile, seed);
+  altser.begin(baud);
+  rx_bit = 0;   // not reset by begin(), left over from a previous run
+  altser.overflow();
+  sim.noteCompareWrites(0);
+}
+
+/*
+  Another device transmits to the AltSoftSerial receive pin
+*/
+RunResult runReceive(const LoadProfile &profile, uint32_t baud, uint32_t numBytes, double jitterPercent, uint32_t seed) {
+  RunResult r = {numBytes, 0, 0, 0, 0};
+  std::mt19937 rng(seed);
+  std::vector<uint8_t> sent(numBytes);
+  std::vector<uint8_t> got;
+  for (uint32_t i = 0; i < numBytes; i++) {
+    sent[i] = rng();
+  }
+
+  startRun(profile, baud, seed);
+  double cyclesPerBit = (double)F_CPU / baud;
+  std::vector<Edge> input = makeWaveform(sent, cyclesPerBit, cyclesPerBit * jitterPercent / 100, 2, 1000, rng);
+  uint64_t until = input.back().t + (uint64_t)(cyclesPerBit * 40);
+  size_t inputIndex = 0;
+
+  while (sim.step(input, inputIndex, until)) {
+    int c;
+    while ((c = altser.read()) >= 0) {
+      got.push_back(c);
+    }
+    if (altser.overflow()) {
+      r.timingErrors++;
+    }
+  }
+  countErrors(sent, got, r);
+  r.maxCaptureLatency = sim.maxCaptureLatency;
+  return r;
+}
+
+/*
+  AltSoftSerial transmits with the buffer kept full, an ideal UART receives
+*/
+RunResult runTransmit(const LoadProfile &profile, uint32_t baud, uint32_t numBytes, uint32_t seed) {
+  RunResult r = {numBytes, 0, 0, 0, 0};
+  std::mt19937 rng(seed);
+  std::vector<uint8_t> sent(numBytes);
+  for (uint32_t i = 0; i < numBytes; i++) {
+    sent[i] = rng();
+  }
+
+  startRun(profile, baud, seed);
+  double cyclesPerBit = (double)F_CPU / baud;
+  std::vector<Edge> noInput;
+  size_t inputIndex = 0;
+  uint32_t written = 0;
+  uint64_t until = (uint64_t)(cyclesPerBit * 10 * numBytes * 4) + 100000;
+
+  do {
+    while (written < numBytes && sim.now >= sim.cpuFreeAt) {
+      uint8_t head = tx_buffer_head + 1;
+      if (head >= TX_BUFFER_SIZE) head = 0;
+      if (head == tx_buffer_tail) break;
+      altser.write(sent[written++]);
+      sim.noteCompareWrites(sim.now);
+    }
+  } while (sim.step(noInput, inputIndex, until) && (written < numBytes || tx_state));
+
+  countErrors(sent, decodeWaveform(sim.txEdges, cyclesPerBit), r);
+  return r;
+}
+
+int main(int argc, char **argv) {
+  uint32_t numBytes = argc > 1 ? atoi(argv[1]) : 20000;
+  double jitterPercent = argc > 2 ? atof(argv[2]) : 3.0;
+  uint32_t seed = argc > 3 ? atoi(argv[3]) : 1;
+
+  const uint32_t bauds[] = {9600, 19200, 31250, 38400, 57600, 74880, 115200};
+
+  const LoadSource millisTick  = {"millis",   16, 16384, 90,  0};
+  const LoadSource debugSerial = {"serial",   19, 1389,  80,  0};
+  const LoadSource motorPWM    = {"motor",     7, 1600,  160, 200};
+  const LoadSource encoder     = {"encoder",   1, 16000, 800, 4000};
+
+  const LoadProfile profiles[] = {
+    {"idle",          {}},
+    {"millis",        {millisTick}},
+    {"millis+serial", {millisTick, debugSerial}},
+    {"motor",         {millisTick, motorPWM}},
+    {"motor+encoder", {millisTick, motorPWM, encoder}},
+  };
+
+  printf("AltSoftSerial ISR simulation: %u bytes per run, edge jitter +/-%.1f%% of a bit, seed %u\n",
+         numBytes, jitterPercent, seed);
+  printf("ISR cost (cycles): capture %d, compare A %d, compare B %d\n\n",
+         CAPTURE_ISR_CYCLES, COMPARE_A_ISR_CYCLES, COMPARE_B_ISR_CYCLES);
+
+  for (const LoadProfile &profile : profiles) {
+    uint32_t maxReliableBaud = 0;
+    bool stillReliable = true;
+
+    printf("Load: %s\n", profile.name);
+    printf("  %7s %13s %12s %9s %12s %10s %12s\n",
+           "baud", "ticks_per_bit", "rx BER", "rx bytes", "timing_err", "max lat", "tx BER");
+
+    for (uint32_t baud : bauds) {
+      RunResult rx = runReceive(profile, baud, numBytes, jitterPercent, seed);
+      RunResult tx = runTransmit(profile, baud, numBytes, seed);
+      double rxBER = (double)rx.bitErrors / (8.0 * rx.bytes);
+      double txBER = (double)tx.bitErrors / (8.0 * tx.bytes);
+      const char *flag = "";
+      if (rx.byteErrors && !rx.timingErrors) {
+        flag = " (undetected)";
+      }
+
+      printf("  %7u %13u %12.2e %9u %12u %8.1fus %12.2e%s\n",
+             baud, ticks_per_bit, rxBER, rx.byteErrors, rx.timingErrors,
+             rx.maxCaptureLatency / (F_CPU / 1e6), txBER, flag);
+
+      if (stillReliable && rx.byteErrors == 0 && tx.byteErrors == 0) {
+        maxReliableBaud = baud;
+      } else {
+        stillReliable = false;
+      }
+    }
+    printf("  max reliable baud: %u\n\n", maxReliableBaud);
+  }
+
+  // a failed run can leave the transmitter mid-byte, and end() would wait for it forever
+  tx_state = 0;
+  return 0;
+}
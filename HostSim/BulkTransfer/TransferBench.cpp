@@ -0,0 +1,208 @@
+/*
+  Sustained throughput of bulk transfers from the Uno to the Mega.
+
+  The Uno streams payloads of random bytes, every value including the packet markers, from 1 KB
+  to 64 KB through beginTransfer() / write() / endTransfer(), feeding write() from the payload as
+  the window frees up. The Mega checks every chunk is the next part of the payload as it arrives.
+  Time is simulated: one pass of loop() costs loopMicros, bytes take one character time to arrive.
+
+  An interrupted run cuts the link for linkDownMillis half way through. The transfer stalls, and
+  is resumed from the last acknowledged offset once the link is back. A run with packets also has
+  the Uno send a normal packet every packetMillis and an urgent one every urgentMillis, which must
+  all arrive while the transfer carries on.
+
+  Build (from the repository root):
+    g++ -std=c++17 -O2 -I HostSim/include -I libraries/BluetoothLink/src \
+        HostSim/BulkTransfer/TransferBench.cpp -o transfer_bench
+    ./transfer_bench [loopMicros] [seed]
+*/
+
+#include <Arduino.h>
+#include <BluetoothLinkSources.h>
+
+#include <stdio.h>
+#include <vector>
+
+#define linkDownMillis    10000
+#define runTimeout        600     // simulated seconds before a run is failed
+#define packetMillis      250
+#define urgentMillis      1000
+
+/*
+  Result of one transfer
+*/
+struct Run {
+  uint64_t micros;
+  unsigned long bytesSent;      // by the Uno, frames sent again and frame overhead included
+  unsigned long timeouts;       // times the Uno went back to the last acknowledged offset
+  unsigned long packets;        // received by the Mega during the transfer
+  unsigned long preemptions;
+};
+
+/*
+  Sends one payload, returns how long it took
+*/
+static Run transfer(const std::vector<byte> &payload, unsigned long baud, unsigned long loopMicros,
+                    boolean interrupt, boolean packets) {
+  HardwareSerial unoPort;
+  Serial3.clear();
+  Serial3.peer = &unoPort;
+  unoPort.peer = &Serial3;
+  Serial3.baud = baud;
+  unoPort.baud = baud;
+
+  BluetoothLink mega(Serial3, 13);
+  BluetoothLink uno(unoPort, 13);
+
+  HostSim::clockMicros = 0;
+  Run run = {0, 0, 0, 0, 0};
+  size_t written = 0;
+  unsigned long received = 0;
+  boolean linkDown = false;
+  uint64_t linkBack = 0;
+  uint64_t nextPacket = (uint64_t)packetMillis * 1000;
+  uint64_t nextUrgent = (uint64_t)urgentMillis * 1000;
+  unsigned long packetsSent = 0;
+
+  if (!uno.beginTransfer(payload.size())) {
+    return run;
+  }
+  boolean ended = false;
+
+  // carry on until the packets sent during the transfer are through as well
+  while (uno.isTransferring() || uno.isSending()) {
+    if (HostSim::clockMicros > (uint64_t)runTimeout * 1000000) {
+      fprintf(stderr, "transfer of %zu bytes at %lu did not finish, %lu acknowledged\n",
+              payload.size(), baud, uno.getTransferAcked());
+      exit(1);
+    }
+
+    // cut the link half way through, bytes sent while it is down are lost
+    if (interrupt && !linkDown && linkBack == 0 && received >= payload.size() / 2) {
+      linkDown = true;
+      linkBack = HostSim::clockMicros + (uint64_t)linkDownMillis * 1000;
+      Serial3.peer = NULL;
+      unoPort.peer = NULL;
+    }
+    if (linkDown && HostSim::clockMicros >= linkBack) {
+      linkDown = false;
+      Serial3.peer = &unoPort;
+      unoPort.peer = &Serial3;
+    }
+
+    // Uno loop()
+    if (written < payload.size()) {
+      written += uno.write(payload.data() + written, payload.size() - written);
+    } else if (!ended) {
+      uno.endTransfer();
+      ended = true;
+    }
+    if (packets && uno.isTransferring() && HostSim::clockMicros >= nextPacket && !uno.isSending(PRIORITY_NORMAL)) {
+      String lines[] = {"TEL", String(packetsSent), "0123456789012345678901234567890123456789"};
+      packetsSent += uno.send(lines, 3, PRIORITY_NORMAL);
+      nextPacket += (uint64_t)packetMillis * 1000;
+    }
+    if (packets && uno.isTransferring() && HostSim::clockMicros >= nextUrgent && !uno.isSending(PRIORITY_URGENT)) {
+      String lines[] = {"STOP", String(packetsSent)};
+      packetsSent += uno.send(lines, 2, PRIORITY_URGENT);
+      nextUrgent += (uint64_t)urgentMillis * 1000;
+    }
+    uno.update();
+    if (uno.transferStalled() && !linkDown) {
+      uno.resumeTransfer();
+    }
+
+    // Mega loop()
+    mega.update();
+    if (mega.receivedTransferData()) {
+      const byte *chunk = mega.getTransferData();
+      int size = mega.getTransferDataSize();
+      if (mega.getTransferOffset() != received || mega.getTransferLength() != payload.size() ||
+          received + size > payload.size() || memcmp(chunk, payload.data() + received, size) != 0) {
+        fprintf(stderr, "chunk at %lu of %zu bytes received wrongly\n", received, payload.size());
+        exit(1);
+      }
+      received += size;
+    }
+    if (mega.receivedNewData()) {
+      run.packets++;
+    }
+
+    HostSim::advance(loopMicros);
+  }
+  Serial3.output.clear();
+  unoPort.output.clear();
+
+  if (received != payload.size() || !uno.transferDelivered() || run.packets != packetsSent) {
+    fprintf(stderr, "transfer of %zu bytes not delivered, %lu received, %lu of %lu packets\n",
+            payload.size(), received, run.packets, packetsSent);
+    exit(1);
+  }
+  run.micros = HostSim::clockMicros;
+  run.timeouts = uno.getStats().retransmits;
+  run.bytesSent = uno.getStats().bytesSent;
+  run.preemptions = uno.getStats().preemptions;
+  return run;
+}
+
+int main(int argc, char **argv) {
+  unsigned long loopMicros = argc > 1 ? strtoul(argv[1], NULL, 10) : 200;
+  unsigned long seed = argc > 2 ? strtoul(argv[2], NULL, 10) : 1;
+  srand(seed);
+
+  // time only moves when the simulated loop says so
+  HostSim::busyWaitMicros = 0;
+
+  unsigned long bauds[] = {9600, 38400, 115200};
+  unsigned long sizes[] = {1024, 2048, 4096, 8192, 16384, 32768, 65536};
+
+  printf("loop pass %lu us, window %d bytes, frames of up to %d escaped bytes\n", loopMicros,
+         transferWindowLength, transferFrameLength);
+  printf("line %% is payload B/s over the line rate of baud/10 B/s\n\n");
+  printf("%7s %8s %10s %8s %10s %10s %8s\n", "baud", "bytes", "seconds", "B/s", "line %",
+         "sent bytes", "timeouts");
+
+  for (unsigned long baud : bauds) {
+    for (unsigned long size : sizes) {
+      std::vector<byte> payload(size);
+      for (unsigned long i = 0; i < size; i++) {
+        payload[i] = rand() & 0xFF;
+      }
+      Run run = transfer(payload, baud, loopMicros, false, false);
+      double seconds = run.micros / 1e6;
+      printf("%7lu %8lu %10.2f %8.0f %9.1f%% %10lu %8lu\n", baud, size, seconds, size / seconds,
+             100.0 * size / seconds / (baud / 10), run.bytesSent, run.timeouts);
+    }
+  }
+
+  printf("\nlink cut for %d ms half way through, then resumed\n\n", linkDownMillis);
+  printf("%7s %8s %10s %10s %10s %8s\n", "baud", "bytes", "seconds", "unbroken", "sent bytes",
+         "timeouts");
+  for (unsigned long baud : bauds) {
+    unsigned long size = 65536;
+    std::vector<byte> payload(size);
+    for (unsigned long i = 0; i < size; i++) {
+      payload[i] = rand() & 0xFF;
+    }
+    Run unbroken = transfer(payload, baud, loopMicros, false, false);
+    Run run = transfer(payload, baud, loopMicros, true, false);
+    printf("%7lu %8lu %10.2f %10.2f %10lu %8lu\n", baud, size, run.micros / 1e6,
+           unbroken.micros / 1e6, run.bytesSent, run.timeouts);
+  }
+
+  printf("\nnormal packet every %d ms and urgent packet every %d ms during the transfer\n\n",
+         packetMillis, urgentMillis);
+  printf("%7s %8s %10s %8s %8s %8s %8s\n", "baud", "bytes", "seconds", "B/s", "packets", "preempt",
+         "timeouts");
+  for (unsigned long baud : bauds) {
+    unsigned long size = 16384;
+    std::vector<byte> payload(size);
+    for (unsigned long i = 0; i < size; i++) {
+      payload[i] = rand() & 0xFF;
+    }
+    Run run = transfer(payload, baud, loopMicros, false, true);
+    printf("%7lu %8lu %10.2f %8.0f %8lu %8lu %8lu\n", baud, size, run.micros / 1e6,
+           size / (run.micros / 1e6), run.packets, run.preemptions, run.timeouts);
+  }
+  return 0;
+}
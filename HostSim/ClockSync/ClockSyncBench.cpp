@@ -0,0 +1,186 @@
+/*
+  Accuracy of the clock offset, drift and one-way latency the Mega estimates for the Uno.
+
+  The Uno and the Mega are paired through two emulated HM-10 modules. The Uno's clock starts
+  offsetMicros ahead of the Mega's and runs fast by a given skew; the bytes the Mega's module
+  sends take asymmetryMicros longer over the air than the Uno's, and every byte up to
+  jitterMicros more. The Uno sends a timestamped telemetry packet every packetMillis, and the
+  idle Mega's heartbeats keep its estimate of the Uno's clock up.
+
+  After warmupSeconds, the estimates are compared with the simulated clocks every sampleMillis:
+  the offset of the Uno's micros() from the Mega's, the drift in ppm, and the age
+  getDataLatency() gives each packet against the time from the Uno's send() to the Mega
+  receiving it. As in NTP, an asymmetric delay shifts the offset by half the asymmetry, and
+  the latency with it. A run fails if the Mega is not synchronised at the end, if the worst
+  offset or latency error is more than maxOffsetError from half the asymmetry, or if the drift
+  estimate is more than maxDriftError from the skew; the exit code is then 1.
+
+  Build (from the repository root):
+    g++ -std=c++17 -O2 -I HostSim/include -I libraries/BluetoothLink/src \
+        HostSim/ClockSync/ClockSyncBench.cpp -o clock_sync_bench
+    ./clock_sync_bench [seconds] [loopMicros] [seed]      seconds more than warmupSeconds
+*/
+
+#include <Arduino.h>
+#include <HM10.h>
+#include <BluetoothLinkSources.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <map>
+
+#define baudRate          9600
+#define offsetMicros      123456789
+#define jitterMicros      5000
+#define packetMillis      200
+#define warmupSeconds     30
+#define sampleMillis      100
+#define maxOffsetError    5         // ms, worst offset and latency error beyond half the asymmetry
+#define maxDriftError     100       // ppm
+
+/*
+  Mean and largest size of an error, in us
+*/
+struct Errors {
+  double total = 0;
+  double worst = 0;
+  unsigned long count = 0;
+
+  void add(double error) {
+    total += error;
+    worst = fabs(error) > fabs(worst) ? error : worst;
+    count++;
+  }
+  double mean() {
+    return count ? total / count : 0;
+  }
+};
+
+/*
+  Selects the clock of the Uno or the Mega for its loop()
+*/
+static void runAsUno(double skewPpm) {
+  HostSim::boardOffsetMicros = offsetMicros;
+  HostSim::boardSkewPpm = skewPpm;
+}
+
+static void runAsMega() {
+  HostSim::boardOffsetMicros = 0;
+  HostSim::boardSkewPpm = 0;
+}
+
+int main(int argc, char **argv) {
+  unsigned long seconds = argc > 1 ? strtoul(argv[1], NULL, 10) : 150;
+  unsigned long loopMicros = argc > 2 ? strtoul(argv[2], NULL, 10) : 200;
+  unsigned long seed = argc > 3 ? strtoul(argv[3], NULL, 10) : 1;
+  if (seconds <= warmupSeconds) {
+    fprintf(stderr, "nothing is measured in the first %d s, run for longer\n", warmupSeconds);
+    return 1;
+  }
+
+  // time only moves when the simulated loop says so
+  HostSim::busyWaitMicros = 0;
+
+  double skews[] = {0, 100, -1000, 5000};
+  unsigned long asymmetries[] = {0, 10000, 40000};
+
+  printf("%d baud, %lu simulated seconds, loop pass %lu us, jitter up to %d us per byte\n", baudRate,
+         seconds, loopMicros, jitterMicros);
+  printf("errors after the first %d s in ms, mean and worst; latency is the true mean\n\n",
+         warmupSeconds);
+  printf("%8s %7s | %8s %8s | %9s %9s | %8s %8s %8s | %6s %6s\n", "skew ppm", "asym ms", "offset",
+         "worst", "drift ppm", "est ppm", "latency", "error", "worst", "synced", "result");
+
+  int runs = 0;
+  int failures = 0;
+
+  for (double skew : skews) {
+    for (unsigned long asymmetry : asymmetries) {
+      srand(seed);
+      HardwareSerial unoPort, megaPort;
+      HM10 unoModule("A81B6AAE5221"), megaModule("D43639BB7C3E");
+      unoModule.role = 1;
+      megaModule.airLatencyMicros += asymmetry;
+      unoModule.airJitterMicros = jitterMicros;
+      megaModule.airJitterMicros = jitterMicros;
+      unoModule.attach(unoPort, baudRate);
+      megaModule.attach(megaPort, baudRate);
+      HM10::pair(unoModule, megaModule);
+      unoModule.connected = true;
+      megaModule.connected = true;
+
+      BluetoothLink uno(unoPort, 2);
+      BluetoothLink mega(megaPort, 3);
+      uno.timestampPackets = true;
+
+      Errors offset, latency, trueLatency;
+      std::map<long, uint64_t> sentAt;    // packet number to when the Uno called send()
+      long packetNumber = 0;
+      uint64_t nextPacket = 0;
+      uint64_t nextSample = (uint64_t)warmupSeconds * 1000000;
+      uint64_t end = (uint64_t)seconds * 1000000;
+      HostSim::clockMicros = 0;
+
+      while (HostSim::clockMicros < end) {
+        unoModule.poll();
+        megaModule.poll();
+
+        // Uno loop()
+        runAsUno(skew);
+        if (HostSim::clockMicros >= nextPacket && !uno.isSending(PRIORITY_NORMAL)) {
+          String lines[] = {"0", String(packetNumber), "3", "4"};
+          if (uno.send(lines, 4, PRIORITY_NORMAL)) {
+            sentAt[packetNumber++] = HostSim::clockMicros;
+          }
+          nextPacket = HostSim::clockMicros + (uint64_t)packetMillis * 1000;
+        }
+        uno.update();
+        uno.receivedNewData();
+        uint32_t unoNow = (uint32_t)HostSim::boardMicros();
+
+        // Mega loop()
+        runAsMega();
+        mega.update();
+        boolean received = mega.receivedNewData();
+        boolean measuring = HostSim::clockMicros >= (uint64_t)warmupSeconds * 1000000;
+
+        if (received && measuring && mega.getDataLatency() != noLatency) {
+          long number = (mega.getData() + 1)->toInt();
+          double age = (double)(HostSim::clockMicros - sentAt[number]);
+          trueLatency.add(age);
+          latency.add(mega.getDataLatency() - age);
+        }
+        if (measuring && HostSim::clockMicros >= nextSample && mega.isClockSynced()) {
+          uint32_t megaNow = (uint32_t)HostSim::boardMicros();
+          offset.add((double)(int32_t)((uint32_t)mega.getClockOffset() - (unoNow - megaNow)));
+          nextSample += (uint64_t)sampleMillis * 1000;
+        }
+
+        HostSim::advance(loopMicros);
+      }
+
+      // the estimates are expected to be off by half the asymmetry
+      double expected = asymmetry / 2.0;
+      boolean passed = mega.isClockSynced() && offset.count > 0 && latency.count > 0 &&
+                       fabs(offset.worst - expected) <= maxOffsetError * 1000.0 &&
+                       fabs(latency.worst - expected) <= maxOffsetError * 1000.0 &&
+                       fabs(mega.getClockDrift() - skew) <= maxDriftError;
+      runs++;
+      if (!passed) {
+        failures++;
+      }
+
+      printf("%8.0f %7.0f | %8.2f %8.2f | %9.0f %9.1f | %8.1f %8.2f %8.2f | %6s %6s\n", skew,
+             asymmetry / 1000.0, offset.mean() / 1000, offset.worst / 1000, skew, mega.getClockDrift(),
+             trueLatency.mean() / 1000, latency.mean() / 1000, latency.worst / 1000,
+             mega.isClockSynced() ? "yes" : "no", passed ? "pass" : "FAIL");
+    }
+  }
+
+  if (failures > 0) {
+    fprintf(stderr, "\n%d of %d runs outside %d ms offset or %d ppm drift error\n", failures, runs,
+            maxOffsetError, maxDriftError);
+    return 1;
+  }
+  return 0;
+}
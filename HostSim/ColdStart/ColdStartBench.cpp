@@ -0,0 +1,241 @@
+/*
+  Time from power-on to the first packet delivered, with and without the EEPROM pairing cache.
+
+  The Uno's module is the central, the Mega's the peripheral, both emulated HM-10 modules that
+  keep their role and name across power cycles. The boards and modules power on together; the
+  Mega runs its setup, then its loop() while the Uno runs its own setup, as the Uno's waits are
+  spent with the Mega's loop and both modules running. The Uno's loop() sends a packet whenever
+  the last one has been delivered or given up on, and the time is taken when the Mega receives
+  the first.
+
+    AT setup   the sketches' setup before the cache: the Mega writes AT+ROLE0 and AT+NAME, the
+               Uno AT+ROLE1 and connects with connect(), every boot
+    cache      setPairingCache() and setupModule(): one AT+ADDR? and, if the module is the one
+               cached, no writes before the Uno's AT+CON
+    sketch     UnoTestFrameWork's own setup(), built from the sketch: beginBluetooth() with the
+               cache and doATCommandSetup(), then sendIntArray() and testAllOrders(), each
+               packet sent with sendAndWait() once the last is acknowledged
+
+  Each is booted four times: from new modules with empty EEPROM, again after a power cycle, with
+  the Uno's module swapped for a new one, and with the Uno's EEPROM erased. The sketch has MegaMAC
+  set for the first boot only, as for a new module, and left empty after: the Mega comes from the
+  cache, or once it is erased from the module's AT+RADD?. Reports each board's setup time, the time
+  from the Uno's power-on to the Mega receiving its packet, the AT commands both modules answered
+  and the settings they changed, the EEPROM bytes written, and for the sketch how many of the
+  packets its setup() sent were delivered. Time is simulated: one pass of loop() costs loopMicros.
+
+  Build (from the repository root):
+    g++ -std=c++17 -O2 -I HostSim/include -I libraries/BluetoothLink/src \
+        HostSim/ColdStart/ColdStartBench.cpp -o cold_start_bench
+    ./cold_start_bench [baud] [loopMicros]
+*/
+
+#include <EEPROM.h>
+#include <HM10.h>
+#include <UnoTestFrameWorkSketch.h>
+
+#include <stdio.h>
+#include <memory>
+#include <new>
+
+#define MEGA_STATE_PIN    3
+#define pairingAddress    0
+#define runTimeout        30      // simulated seconds from the Uno's power-on before a boot is failed
+
+enum Setup { SETUP_AT, SETUP_CACHE, SETUP_SKETCH };
+
+/*
+  Result of one boot, times in ms
+*/
+struct Boot {
+  double megaSetup;
+  double unoSetup;
+  double firstPacket;       // from the Uno's power-on
+  unsigned long commands;   // answered by both modules
+  unsigned long writes;
+  unsigned long eepromBytes;
+  unsigned long delivered;  // of the packets the sketch's setup() sent
+  unsigned long sent;
+};
+
+/*
+  What lasts across power cycles: the modules' flash and each board's EEPROM
+*/
+struct Bench {
+  std::unique_ptr<HM10> unoModule, megaModule;
+  EEPROMClass unoEEPROM, megaEEPROM;
+  unsigned long baud;
+  unsigned long loopMicros;
+
+  // the board running now, whose loop() and modules run while the other waits
+  BluetoothLink *mega = nullptr;
+  boolean megaReceived = false;
+  uint64_t megaReceivedTime = 0;
+  uint64_t megaLastLoop = 0;
+};
+
+static Bench *bench;
+
+static void megaLoop() {
+  bench->mega->update();
+  if (bench->mega->receivedNewData() && !bench->megaReceived) {
+    bench->megaReceived = true;
+    bench->megaReceivedTime = HostSim::clockMicros;
+  }
+  bench->megaLastLoop = HostSim::clockMicros;
+}
+
+/*
+  Runs whenever a sketch waits: the modules, and the Mega's loop() once it has been set up
+*/
+static void background() {
+  bench->unoModule->poll();
+  bench->megaModule->poll();
+  if (bench->mega != nullptr && HostSim::clockMicros - bench->megaLastLoop >= bench->loopMicros) {
+    EEPROMClass unoEEPROM = EEPROM;
+    EEPROM = bench->megaEEPROM;
+    megaLoop();
+    bench->megaEEPROM = EEPROM;
+    EEPROM = unoEEPROM;
+  }
+}
+
+static double millisSince(uint64_t from) {
+  return (HostSim::clockMicros - from) / 1000.0;
+}
+
+static Boot boot(Setup setup, const char *megaMAC) {
+  Boot result;
+  unsigned long commandsBefore = bench->unoModule->commands + bench->megaModule->commands;
+  unsigned long writesBefore = bench->unoModule->writes + bench->megaModule->writes;
+  unsigned long eepromBefore = bench->unoEEPROM.bytesWritten + bench->megaEEPROM.bytesWritten;
+
+  // power on, the sketch's globals as they are at reset
+  bench->unoModule->restart();
+  bench->megaModule->restart();
+  HardwareSerial unoPort, megaPort;
+  bluetooth.~BluetoothLink();
+  new (&bluetooth) BluetoothLink(BTSerial, connectionStatusPin);
+  BTSerial.clear();
+  Serial.clear();
+  MegaMAC = megaMAC;
+  bench->unoModule->attach(setup == SETUP_SKETCH ? BTSerial : unoPort, bench->baud);
+  bench->megaModule->attach(megaPort, bench->baud);
+  bench->unoModule->poll();
+  bench->megaModule->poll();
+  bench->mega = nullptr;
+  bench->megaReceived = false;
+
+  // Mega setup()
+  uint64_t start = HostSim::clockMicros;
+  BluetoothLink mega(megaPort, MEGA_STATE_PIN);
+  EEPROM = bench->megaEEPROM;
+  if (setup == SETUP_AT) {
+    if (mega.canDoAT()) {
+      mega.changeRole(0);
+      mega.changeName("MegaBluetooth");
+    }
+  } else {
+    mega.setPairingCache(pairingAddress, bench->baud);
+    mega.setupModule(0, "MegaBluetooth");
+  }
+  bench->megaEEPROM = EEPROM;
+  result.megaSetup = millisSince(start);
+  bench->mega = &mega;
+
+  // Uno setup()
+  uint64_t unoStart = HostSim::clockMicros;
+  BluetoothLink unoLink(unoPort, connectionStatusPin);
+  BluetoothLink &uno = setup == SETUP_SKETCH ? bluetooth : unoLink;
+  EEPROM = bench->unoEEPROM;
+  String lines[] = {String(MESSAGE_CANS_ERROR), "1", "2", "3"};
+  if (setup == SETUP_AT) {
+    uno.setPeerMAC(String(bench->megaModule->address.c_str()));
+    uno.changeRole(1);
+    uno.connect();
+  } else if (setup == SETUP_CACHE) {
+    uno.setPeerMAC(String(bench->megaModule->address.c_str()));
+    uno.setPairingCache(pairingAddress, bench->baud);
+    uno.setupModule(1, "");
+  } else {
+    ::setup();
+  }
+  result.delivered = uno.getStats().packetsSent;
+  result.sent = result.delivered + uno.getStats().sendFailures;
+  result.unoSetup = millisSince(unoStart);
+
+  // loop() on both, the Uno sending whenever the last packet is done with
+  while (!bench->megaReceived) {
+    if (HostSim::clockMicros - unoStart > (uint64_t)runTimeout * 1000000) {
+      fprintf(stderr, "no packet %d s after the Uno's power-on\n", runTimeout);
+      exit(1);
+    }
+    HostSim::spend(0);    // the modules and the Mega's loop()
+    if (!uno.isSending(PRIORITY_NORMAL)) {
+      uno.send(lines, 4, PRIORITY_NORMAL);
+    }
+    uno.update();
+    HostSim::advance(bench->loopMicros);
+  }
+  result.firstPacket = (bench->megaReceivedTime - unoStart) / 1000.0;
+  bench->unoEEPROM = EEPROM;
+  bench->mega = nullptr;
+  // the boards' ports go with them
+  BTSerial.peer = nullptr;
+  bench->unoModule->uart.peer = nullptr;
+  bench->megaModule->uart.peer = nullptr;
+
+  result.commands = bench->unoModule->commands + bench->megaModule->commands - commandsBefore;
+  result.writes = bench->unoModule->writes + bench->megaModule->writes - writesBefore;
+  result.eepromBytes = bench->unoEEPROM.bytesWritten + bench->megaEEPROM.bytesWritten - eepromBefore;
+  return result;
+}
+
+int main(int argc, char **argv) {
+  unsigned long baud = argc > 1 ? strtoul(argv[1], NULL, 10) : 9600;
+  unsigned long loopMicros = argc > 2 ? strtoul(argv[2], NULL, 10) : 200;
+
+  HostSim::background = background;
+
+  printf("%lu baud, loop pass %lu us, times in ms\n\n", baud, loopMicros);
+  printf("%9s %14s | %10s %9s %12s | %8s %7s %7s | %9s\n", "setup", "boot", "Mega setup", "Uno setup",
+         "first packet", "AT cmds", "writes", "EEPROM", "delivered");
+
+  struct {
+    const char *name;
+    Setup setup;
+  } setups[] = {{"AT setup", SETUP_AT}, {"cache", SETUP_CACHE}, {"sketch", SETUP_SKETCH}};
+
+  for (auto &s : setups) {
+    Bench b;
+    bench = &b;
+    b.baud = baud;
+    b.loopMicros = loopMicros;
+    b.unoModule.reset(new HM10("A81B6AAE5221"));
+    b.megaModule.reset(new HM10("D43639BB7C3E"));
+    b.unoModule->statePin = connectionStatusPin;
+    b.megaModule->statePin = MEGA_STATE_PIN;
+    HM10::pair(*b.unoModule, *b.megaModule);
+
+    const char *boots[] = {"first", "power cycle", "module swapped", "EEPROM erased"};
+    for (int i = 0; i < 4; i++) {
+      if (i == 2) {
+        b.unoModule.reset(new HM10("A81B6AAE9999"));
+        b.unoModule->statePin = connectionStatusPin;
+        HM10::pair(*b.unoModule, *b.megaModule);
+      }
+      if (i == 3) {
+        b.unoEEPROM.erase();
+      }
+      // MegaMAC as a new module needs it, then left empty as the sketch ships
+      Boot r = boot(s.setup, i == 0 ? b.megaModule->address.c_str() : "");
+      String delivered = s.setup == SETUP_SKETCH ? String(r.delivered) + "/" + String(r.sent) : "-";
+      printf("%9s %14s | %10.0f %9.0f %12.0f | %8lu %7lu %7lu | %9s\n", s.name, boots[i], r.megaSetup,
+             r.unoSetup, r.firstPacket, r.commands, r.writes, r.eepromBytes, delivered.c_str());
+      // nothing is left running into the next boot
+      HostSim::advance(1000000);
+    }
+  }
+  HostSim::background = nullptr;
+  return 0;
+}
@@ -0,0 +1,165 @@
+/*
+  Cost of getting a received packet to the code it is meant for, with and without message handlers.
+
+    stored    the packet is stored as a String[] for getData(), and the sketch compares the first
+              line with the name of each message kind in turn, as writeToVariables() did with
+              "INT", then converts the lines with toInt()
+    table     setHandlers(): the first line is the message type, update() calls the handler at
+              that index with the lines ended in place in the packet buffer, converted with atoi()
+
+  Each packet is the last of 1 to maxKinds message kinds, so the stored path makes every compare,
+  with the order packet's 4 lines and with 12. Reports the host ns per message for the whole of
+  reading, checking and handling the packet, the same for both, and the heap allocations made
+  for each, the fastest of repeats runs. The host's String keeps short lines without allocating,
+  so only the String[] is counted there; on the AVR every line is a malloc() as well. Numbers are
+  for the host CPU; compare runs on the same machine.
+
+  Build (from the repository root):
+    g++ -std=c++17 -O2 -I HostSim/include -I libraries/BluetoothLink/src \
+        HostSim/Dispatch/DispatchBench.cpp -o dispatch_bench
+    ./dispatch_bench [iterations]
+*/
+
+#include <Arduino.h>
+#include <BluetoothLinkSources.h>
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <new>
+
+#define maxKinds      16
+#define maxLines      12
+#define repeats       5
+
+// heap allocations since the start, counted by operator new
+static unsigned long allocations = 0;
+
+void *operator new(size_t size) {
+  allocations++;
+  void *p = malloc(size ? size : 1);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+// what the handlers write to, as the sketches' cans errors
+static long values[maxLines];
+static unsigned long handled = 0;
+static String kindNames[maxKinds];
+
+/*
+  The sketch side of the stored path: one compare per message kind until the name matches
+*/
+static void writeToVariables(BluetoothLink &link, int kinds) {
+  String *stored = link.getData();
+  if (link.getDataSize() == 0) {
+    return;
+  }
+  for (int k = 0; k < kinds; k++) {
+    if ((*stored).equals(kindNames[k])) {
+      for (int i = 1; i < link.getDataSize(); i++) {
+        values[i] = (*(stored + i)).toInt();
+      }
+      handled++;
+      return;
+    }
+  }
+}
+
+static void handleMessage(const BluetoothMessage &message) {
+  for (int i = 1; i < message.lineCount; i++) {
+    values[i] = atoi(*(message.lines + i));
+  }
+  handled++;
+}
+
+static void unknownMessage(const BluetoothMessage &message) {
+  (void)message;
+}
+
+struct Result {
+  double nanos;
+  double allocations;
+};
+
+static Result run(boolean table, int kinds, int lines, unsigned long iterations) {
+  HardwareSerial port;
+  BluetoothLink link(port, 0);
+  BluetoothHandler handlers[maxKinds];
+  for (int k = 0; k < kinds; k++) {
+    handlers[k] = handleMessage;
+  }
+  if (table) {
+    link.setHandlers(handlers, kinds, unknownMessage);
+  }
+
+  String data[maxLines];
+  data[0] = table ? String(kinds - 1) : kindNames[kinds - 1];
+  for (int i = 1; i < lines; i++) {
+    data[i] = String((i * 37) % 100);
+  }
+  String packet = BluetoothLink::buildPacket(data, lines);
+
+  uint64_t totalNanos = 0;
+  unsigned long allocated = 0;
+  handled = 0;
+  for (unsigned long i = 0; i < iterations; i++) {
+    port.inject(packet);
+    unsigned long allocationsBefore = allocations;
+    auto start = std::chrono::steady_clock::now();
+    boolean received = false;
+    while (!received && port.available() > 0) {
+      link.update();
+      received = link.receivedNewData();
+    }
+    if (!table) {
+      writeToVariables(link, kinds);
+    }
+    auto end = std::chrono::steady_clock::now();
+    allocated += allocations - allocationsBefore;
+    totalNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    port.output.clear();
+  }
+  if (handled != iterations) {
+    fprintf(stderr, "%lu of %lu messages handled\n", handled, iterations);
+    exit(1);
+  }
+  return {totalNanos / (double)iterations, allocated / (double)iterations};
+}
+
+int main(int argc, char **argv) {
+  unsigned long iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+
+  const char *names[] = {"INT", "FLOAT", "STATUS", "POSITION", "ORDER", "STOP", "SPEED", "HEADING",
+                         "BATTERY", "SENSOR", "MOTOR", "ERROR", "LOG", "TIME", "CONFIG", "TEST"};
+  for (int k = 0; k < maxKinds; k++) {
+    kindNames[k] = names[k];
+  }
+
+  printf("Message dispatch, %lu messages each, ns per message and heap allocations\n\n", iterations);
+  printf("%5s %5s | %9s %7s | %9s %7s | %8s\n", "lines", "kinds", "stored ns", "allocs", "table ns",
+         "allocs", "saved ns");
+
+  int lineCounts[] = {4, maxLines};
+  int kindCounts[] = {1, 4, maxKinds};
+  for (int lines : lineCounts) {
+    for (int kinds : kindCounts) {
+      Result stored = run(false, kinds, lines, iterations);
+      Result table = run(true, kinds, lines, iterations);
+      for (int r = 1; r < repeats; r++) {
+        stored.nanos = std::min(stored.nanos, run(false, kinds, lines, iterations).nanos);
+        table.nanos = std::min(table.nanos, run(true, kinds, lines, iterations).nanos);
+      }
+      printf("%5d %5d | %9.1f %7.1f | %9.1f %7.1f | %8.1f\n", lines, kinds, stored.nanos, stored.allocations,
+             table.nanos, table.allocations, stored.nanos - table.nanos);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,182 @@
+/*
+  Aggregate throughput of several BluetoothLink instances serviced from one loop.
+
+  The Mega runs a link on each of Serial1, Serial2 and Serial3, every one paired with a remote
+  device on its own simulated UART. Both ends of every link send packets back to back, and each
+  received packet is checked to have come from the right device in the right order. Time is
+  simulated: one pass of loop() costs loopMicros, bytes take one character time to arrive.
+
+  Reports the payload delivered per second for 1 to 3 links at each baud rate, and the host time
+  of the Mega's update() calls, which must stay bounded however much data is waiting.
+
+  Build (from the repository root):
+    g++ -std=c++17 -O2 -I HostSim/include -I libraries/BluetoothLink/src \
+        HostSim/MultiLink/MultiLinkBench.cpp -o multilink_bench
+    ./multilink_bench [seconds] [loopMicros]
+*/
+
+#include <Arduino.h>
+#include <BluetoothLinkSources.h>
+
+#include <stdio.h>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#define MAX_LINKS     3
+#define LINES         8
+#define LINE_LENGTH   24
+
+/*
+  One end of a link and what it has sent and received
+*/
+struct Endpoint {
+  std::unique_ptr<BluetoothLink> link;
+  char id;
+  unsigned long nextSequence = 0;       // of the next packet to send
+  unsigned long expectedSequence = 0;   // of the next packet from the other end
+  unsigned long payloadReceived = 0;
+  unsigned long outOfOrder = 0;
+};
+
+/*
+  Queues the next packet if the last one has been delivered or given up on
+*/
+static void sendNext(Endpoint &end) {
+  if (end.link->isSending()) {
+    return;
+  }
+  if (end.nextSequence > 0 && !end.link->lastSendDelivered()) {
+    end.nextSequence--;   // send the same sequence number again
+  }
+  String lines[LINES];
+  lines[0] = String(end.id) + String(end.nextSequence);
+  for (int i = 1; i < LINES; i++) {
+    for (int c = 0; c < LINE_LENGTH; c++) {
+      lines[i].concat((char)('a' + (i + c + end.nextSequence) % 26));
+    }
+  }
+  if (end.link->send(lines, LINES)) {
+    end.nextSequence++;
+  }
+}
+
+/*
+  Checks a received packet came from the other end of this link, in order
+*/
+static void checkReceived(Endpoint &end, char peerId) {
+  if (!end.link->receivedNewData()) {
+    return;
+  }
+  String *data = end.link->getData();
+  int size = end.link->getDataSize();
+  if (size != LINES || data->charAt(0) != peerId) {
+    fprintf(stderr, "link %c received a packet from the wrong device\n", end.id);
+    exit(1);
+  }
+  unsigned long sequence = data->substring(1).toInt();
+  if (sequence == end.expectedSequence) {
+    end.expectedSequence++;
+    for (int i = 0; i < size; i++) {
+      end.payloadReceived += (data + i)->length();
+    }
+  } else if (sequence + 1 != end.expectedSequence) {
+    // a repeat of the last packet, after its acknowledgement was lost, is expected
+    end.outOfOrder++;
+  }
+}
+
+int main(int argc, char **argv) {
+  unsigned long seconds = argc > 1 ? strtoul(argv[1], NULL, 10) : 20;
+  unsigned long loopMicros = argc > 2 ? strtoul(argv[2], NULL, 10) : 200;
+
+  // time only moves when the simulated loop says so
+  HostSim::busyWaitMicros = 0;
+
+  HardwareSerial *megaPorts[MAX_LINKS] = {&Serial1, &Serial2, &Serial3};
+  HardwareSerial remotePorts[MAX_LINKS];
+  unsigned long bauds[] = {9600, 38400, 115200};
+
+  printf("%lu simulated seconds, loop pass %lu us, packets of %d lines x %d chars\n\n",
+         seconds, loopMicros, LINES, LINE_LENGTH);
+  printf("%5s %7s %12s %12s %12s %8s %8s %12s %12s %10s\n", "links", "baud", "to Mega B/s",
+         "from Mega B/s", "aggregate", "resent", "failed", "update mean", "update max", "max bytes");
+
+  for (unsigned long baud : bauds) {
+    for (int numLinks = 1; numLinks <= MAX_LINKS; numLinks++) {
+      Endpoint mega[MAX_LINKS];
+      Endpoint remote[MAX_LINKS];
+
+      for (int i = 0; i < numLinks; i++) {
+        megaPorts[i]->clear();
+        remotePorts[i].clear();
+        megaPorts[i]->peer = &remotePorts[i];
+        remotePorts[i].peer = megaPorts[i];
+        megaPorts[i]->baud = baud;
+        remotePorts[i].baud = baud;
+
+        mega[i].link.reset(new BluetoothLink(*megaPorts[i], 13));
+        remote[i].link.reset(new BluetoothLink(remotePorts[i], 13));
+        mega[i].link->transmitAttempts = 3;
+        remote[i].link->transmitAttempts = 3;
+        mega[i].id = 'A' + i;
+        remote[i].id = 'a' + i;
+      }
+
+      uint64_t updateNanos = 0;
+      uint64_t worstUpdateNanos = 0;
+      unsigned long updates = 0;
+      unsigned long worstBytes = 0;
+
+      HostSim::clockMicros = 0;
+      uint64_t end = (uint64_t)seconds * 1000000;
+      while (HostSim::clockMicros < end) {
+        // one pass of the Mega's loop(), servicing every link
+        for (int i = 0; i < numLinks; i++) {
+          sendNext(mega[i]);
+
+          unsigned long bytesBefore = mega[i].link->getStats().bytesReceived;
+          auto start = std::chrono::steady_clock::now();
+          mega[i].link->update();
+          uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now() - start).count();
+          unsigned long bytes = mega[i].link->getStats().bytesReceived - bytesBefore;
+
+          updateNanos += nanos;
+          updates++;
+          if (nanos > worstUpdateNanos) worstUpdateNanos = nanos;
+          if (bytes > worstBytes) worstBytes = bytes;
+
+          checkReceived(mega[i], remote[i].id);
+        }
+
+        // the remote devices run their own loops
+        for (int i = 0; i < numLinks; i++) {
+          sendNext(remote[i]);
+          remote[i].link->update();
+          checkReceived(remote[i], mega[i].id);
+        }
+
+        HostSim::advance(loopMicros);
+      }
+
+      unsigned long toMega = 0, fromMega = 0, resent = 0, failed = 0, outOfOrder = 0;
+      for (int i = 0; i < numLinks; i++) {
+        toMega += mega[i].payloadReceived;
+        fromMega += remote[i].payloadReceived;
+        resent += mega[i].link->getStats().retransmits + remote[i].link->getStats().retransmits;
+        failed += mega[i].link->getStats().sendFailures + remote[i].link->getStats().sendFailures;
+        outOfOrder += mega[i].outOfOrder + remote[i].outOfOrder;
+      }
+      if (outOfOrder) {
+        fprintf(stderr, "%lu packets received out of order\n", outOfOrder);
+        return 1;
+      }
+
+      printf("%5d %7lu %12lu %12lu %12lu %8lu %8lu %9.0f ns %9llu ns %10lu\n", numLinks, baud,
+             toMega / seconds, fromMega / seconds, (toMega + fromMega) / seconds, resent, failed,
+             updateNanos / (double)updates, (unsigned long long)worstUpdateNanos, worstBytes);
+    }
+  }
+  return 0;
+}
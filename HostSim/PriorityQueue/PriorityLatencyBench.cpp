@@ -0,0 +1,197 @@
+/*
+  Latency of a stop command sent while both devices are streaming telemetry.
+
+  The Uno and the Mega are paired over a simulated UART. Both keep their send queues full of
+  normal telemetry packets, topped up on every pass of loop(). At random intervals of 100 to
+  400 ms the Uno sends a stop command, either as PRIORITY_URGENT ("priority") or as an ordinary
+  PRIORITY_NORMAL packet behind the telemetry ("fifo"). A fifo command that finds the queue full
+  is offered again on every pass until send() takes it, as a sketch would have to.
+
+  Reports, for each baud rate and mode, the time from the Uno deciding to send the command to
+  the Mega passing it on (delivery) and to the Uno seeing its acknowledgement, and the telemetry
+  still delivered in each direction. Time is simulated: one pass of loop() costs loopMicros.
+
+  Build (from the repository root):
+    g++ -std=c++17 -O2 -I HostSim/include -I libraries/BluetoothLink/src \
+        HostSim/PriorityQueue/PriorityLatencyBench.cpp -o priority_bench
+    ./priority_bench [seconds] [loopMicros] [seed]
+*/
+
+#include <Arduino.h>
+#include <BluetoothLinkSources.h>
+
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+#define LINES         8
+#define LINE_LENGTH   24
+
+/*
+  Latencies of one run, in microseconds
+*/
+struct Latencies {
+  std::vector<uint64_t> samples;
+
+  void print() {
+    if (samples.empty()) {
+      printf(" %9s %9s %9s", "-", "-", "-");
+      return;
+    }
+    std::sort(samples.begin(), samples.end());
+    uint64_t total = 0;
+    for (uint64_t s : samples) {
+      total += s;
+    }
+    size_t p99 = (samples.size() * 99) / 100;
+    if (p99 >= samples.size()) {
+      p99 = samples.size() - 1;
+    }
+    printf(" %9.1f %9.1f %9.1f", total / (double)samples.size() / 1000.0,
+           samples[p99] / 1000.0, samples.back() / 1000.0);
+  }
+};
+
+/*
+  Fills the normal send queue with telemetry packets
+*/
+static void topUpTelemetry(BluetoothLink &link, char id, unsigned long &sequence) {
+  for (;;) {
+    String lines[LINES];
+    lines[0] = String(id) + String(sequence);
+    for (int i = 1; i < LINES; i++) {
+      for (int c = 0; c < LINE_LENGTH; c++) {
+        lines[i].concat((char)('a' + (i + c + sequence) % 26));
+      }
+    }
+    if (!link.send(lines, LINES, PRIORITY_NORMAL)) {
+      return;
+    }
+    sequence++;
+  }
+}
+
+/*
+  Adds up the telemetry payload of a received packet, returns the command number if it was one
+*/
+static long readReceived(BluetoothLink &link, unsigned long &telemetryBytes) {
+  if (!link.receivedNewData()) {
+    return -1;
+  }
+  String *data = link.getData();
+  if (link.getDataSize() == 2 && data->equals("STOP")) {
+    return (data + 1)->toInt();
+  }
+  for (int i = 0; i < link.getDataSize(); i++) {
+    telemetryBytes += (data + i)->length();
+  }
+  return -1;
+}
+
+int main(int argc, char **argv) {
+  unsigned long seconds = argc > 1 ? strtoul(argv[1], NULL, 10) : 30;
+  unsigned long loopMicros = argc > 2 ? strtoul(argv[2], NULL, 10) : 200;
+  unsigned long seed = argc > 3 ? strtoul(argv[3], NULL, 10) : 1;
+
+  // time only moves when the simulated loop says so
+  HostSim::busyWaitMicros = 0;
+
+  unsigned long bauds[] = {9600, 38400, 115200};
+  const char *modes[] = {"priority", "fifo"};
+
+  printf("%lu simulated seconds, loop pass %lu us, telemetry packets of %d lines x %d chars\n",
+         seconds, loopMicros, LINES, LINE_LENGTH);
+  printf("stop command every 100-400 ms, latencies in ms\n\n");
+  printf("%7s %9s %6s | %9s %9s %9s | %9s %9s %9s | %9s %9s %8s %8s %8s\n", "baud", "mode", "sent",
+         "dlv mean", "dlv p99", "dlv max", "ack mean", "ack p99", "ack max",
+         "to Mega", "from Mega", "preempt", "failed", "worst");
+
+  for (unsigned long baud : bauds) {
+    for (int mode = 0; mode < 2; mode++) {
+      byte commandPriority = mode == 0 ? PRIORITY_URGENT : PRIORITY_NORMAL;
+      randomSeed(seed);
+
+      HardwareSerial unoPort;
+      Serial3.clear();
+      Serial3.peer = &unoPort;
+      unoPort.peer = &Serial3;
+      Serial3.baud = baud;
+      unoPort.baud = baud;
+
+      BluetoothLink mega(Serial3, 13);
+      BluetoothLink uno(unoPort, 13);
+      mega.transmitAttempts = 3;
+      uno.transmitAttempts = 3;
+
+      unsigned long megaSequence = 0, unoSequence = 0;
+      unsigned long toMega = 0, fromMega = 0;
+      Latencies delivery, acknowledge;
+
+      long commandNumber = 0;
+      boolean commandWaiting = false;   // decided on, not yet taken by send()
+      boolean commandInFlight = false;  // taken by send(), not yet delivered and acknowledged
+      boolean commandDelivered = false;
+      boolean commandAcked = false;
+      uint64_t commandTime = 0;
+      unsigned long commandsSent = 0;
+
+      HostSim::clockMicros = 0;
+      uint64_t nextCommand = (uint64_t)random(100, 401) * 1000;
+      uint64_t end = (uint64_t)seconds * 1000000;
+      while (HostSim::clockMicros < end) {
+        // Uno loop(): the stop command goes first, then telemetry fills what is left
+        if (!commandWaiting && !commandInFlight && HostSim::clockMicros >= nextCommand) {
+          commandWaiting = true;
+          commandTime = HostSim::clockMicros;
+        }
+        if (commandWaiting) {
+          String command[] = {"STOP", String(commandNumber)};
+          if (uno.send(command, 2, commandPriority)) {
+            commandWaiting = false;
+            commandInFlight = true;
+            commandDelivered = false;
+            commandAcked = commandPriority != PRIORITY_URGENT;   // fifo acks are not tracked
+            commandsSent++;
+          }
+        }
+        topUpTelemetry(uno, 'u', unoSequence);
+        uno.update();
+        readReceived(uno, fromMega);
+        if (commandInFlight && !commandAcked && !uno.isSending(PRIORITY_URGENT)) {
+          commandAcked = true;
+          if (uno.lastSendDelivered(PRIORITY_URGENT)) {
+            acknowledge.samples.push_back(HostSim::clockMicros - commandTime);
+          }
+        }
+
+        // Mega loop()
+        topUpTelemetry(mega, 'm', megaSequence);
+        mega.update();
+        long received = readReceived(mega, toMega);
+        if (commandInFlight && received == commandNumber) {
+          commandDelivered = true;
+          delivery.samples.push_back(HostSim::clockMicros - commandTime);
+        }
+
+        if (commandInFlight && commandAcked &&
+            (commandDelivered || (commandPriority == PRIORITY_URGENT && !uno.lastSendDelivered(PRIORITY_URGENT)))) {
+          commandInFlight = false;
+          commandNumber++;
+          nextCommand = HostSim::clockMicros + (uint64_t)random(100, 401) * 1000;
+        }
+
+        HostSim::advance(loopMicros);
+      }
+
+      const BluetoothLinkStats &unoStats = uno.getStats();
+      printf("%7lu %9s %6lu |", baud, modes[mode], commandsSent);
+      delivery.print();
+      printf(" |");
+      acknowledge.print();
+      printf(" | %9lu %9lu %8lu %8lu %8lu\n", toMega / seconds, fromMega / seconds,
+             unoStats.preemptions, unoStats.sendFailures + mega.getStats().sendFailures,
+             unoStats.worstUrgentLatency);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,174 @@
+/*
+  Throughput micro-benchmark for the receive path of the Uno sketch.
+
+  Each stage of decoding a packet is timed on its own for packets of increasing size: checking
+  the checksum, skipping it, and rebuildData() storing the lines, which also takes off their
+  markers as removeMarkers() used to. The link's update() is timed from the Serial to the stored
+  lines, and receivedNewData() end to end, over as many calls as the packet needs. Building the
+  packet on the sending side is timed for comparison. Reports the mean ns per packet byte
+  and the worst case host cycles for one packet, so a stage that stops scaling linearly stands out.
+  Numbers are for the host CPU; compare runs on the same machine.
+
+  Build (from the repository root):
+    g++ -std=c++17 -O2 -I HostSim/include -I libraries/BluetoothLink/src \
+        HostSim/ReceivePath/ReceiveBench.cpp -o receive_bench
+    ./receive_bench [iterations]
+*/
+
+#include <UnoTestFrameWorkSketch.h>
+
+#include <stdio.h>
+#include <chrono>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t cycles() { return __rdtsc(); }
+#else
+static inline uint64_t cycles() {
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+#endif
+
+enum Stage {
+  STAGE_BUILD,
+  STAGE_CONFIRM_CHECKSUM,
+  STAGE_SKIP_CHECKSUM,
+  STAGE_REBUILD,
+  STAGE_UPDATE,
+  STAGE_TOTAL,
+  NUM_STAGES
+};
+
+static const char *stageNames[NUM_STAGES] = {
+  "buildPacket", "confirmCheckSum", "skipCheckSum", "rebuildData", "update", "receivedNewData"
+};
+
+struct StageTime {
+  uint64_t totalNanos = 0;
+  uint64_t worstCycles = 0;
+};
+
+template <typename F>
+static void timeStage(StageTime &t, F f) {
+  auto start = std::chrono::steady_clock::now();
+  uint64_t c0 = cycles();
+  f();
+  uint64_t c1 = cycles();
+  auto end = std::chrono::steady_clock::now();
+  t.totalNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+  if (c1 - c0 > t.worstCycles) {
+    t.worstCycles = c1 - c0;
+  }
+}
+
+/*
+  A packet of numLines lines of lineLength characters, built the same way sendData() does
+*/
+static String makePacket(int numLines, int lineLength, String lines[]) {
+  for (int i = 0; i < numLines; i++) {
+    String line = "";
+    for (int c = 0; c < lineLength; c++) {
+      line.concat((char)('a' + (i + c) % 26));
+    }
+    lines[i] = line;
+  }
+  return BluetoothLink::buildPacket(lines, numLines);
+}
+
+int main(int argc, char **argv) {
+  unsigned long iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 20000;
+
+  // the order packet the Uno actually receives, then larger packets up to maxPacketLength
+  struct { int lines; int length; } shapes[] = {{4, 1}, {4, 8}, {8, 12}, {16, 10}, {32, 5}, {48, 3}};
+  const int numShapes = sizeof(shapes) / sizeof(shapes[0]);
+  std::vector<std::vector<String>> lines(numShapes, std::vector<String>(64));
+  std::vector<String> packets;
+  for (int s = 0; s < numShapes; s++) {
+    packets.push_back(makePacket(shapes[s].lines, shapes[s].length, lines[s].data()));
+  }
+  lines[0][0] = String(MESSAGE_CANS_ERROR);
+  packets[0] = receiveTestData;
+
+  printf("Receive path, %lu packets per size\n", iterations);
+  printf("%-18s", "packet bytes");
+  for (const String &packet : packets) {
+    printf(" %16u", packet.length());
+  }
+  printf("\n%-18s", "");
+  for (size_t i = 0; i < packets.size(); i++) {
+    printf(" %8s %7s", "ns/byte", "worst");
+  }
+  printf("\n");
+
+  // the stages are run on their own link, so nothing they store reaches the sketch's
+  HardwareSerial stagePort;
+  BluetoothLink stageLink(stagePort, 0);
+  char buffer[maxPacketLength + 1];
+
+  std::vector<std::vector<StageTime>> results;
+  for (int s = 0; s < numShapes; s++) {
+    const String &packet = packets[s];
+    if (packet.length() > maxPacketLength) {
+      fprintf(stderr, "packet longer than maxPacketLength\n");
+      return 1;
+    }
+    std::vector<StageTime> times(NUM_STAGES);
+
+    for (unsigned long i = 0; i < iterations; i++) {
+      // each stage on its own
+      timeStage(times[STAGE_BUILD], [&] { BluetoothLink::buildPacket(lines[s].data(), shapes[s].lines); });
+      // the packet as update() holds it, without packet markers
+      int len = packet.length() - 2;
+      memcpy(buffer, packet.c_str() + 1, len);
+      buffer[len] = '\0';
+      boolean valid = false;
+      char *body = NULL;
+      timeStage(times[STAGE_CONFIRM_CHECKSUM], [&] { valid = BluetoothLink::confirmCheckSum(buffer, len); });
+      timeStage(times[STAGE_SKIP_CHECKSUM], [&] { body = BluetoothLink::skipCheckSum(buffer); });
+      if (!valid) {
+        fprintf(stderr, "benchmark packet failed its checksum\n");
+        return 1;
+      }
+      timeStage(times[STAGE_REBUILD], [&] { stageLink.rebuildData(body, len - (body - buffer)); });
+      if (stageLink.getDataSize() != shapes[s].lines) {
+        fprintf(stderr, "benchmark packet rebuilt into %d lines\n", stageLink.getDataSize());
+        return 1;
+      }
+      BTSerial.inject(packet);
+      timeStage(times[STAGE_UPDATE], [&] {
+        while (BTSerial.available() > 0) {
+          bluetooth.update();
+        }
+      });
+      bluetooth.receivedNewData();
+      BTSerial.output.clear();
+
+      // and the whole path, as loop() would call it
+      BTSerial.inject(packet);
+      timeStage(times[STAGE_TOTAL], [&] {
+        boolean received = false;
+        while (!received && BTSerial.available() > 0) {
+          received = receivedNewData();
+        }
+        if (!received) {
+          fprintf(stderr, "benchmark packet rejected\n");
+          exit(1);
+        }
+      });
+      BTSerial.output.clear();
+    }
+    results.push_back(times);
+  }
+
+  for (int stage = 0; stage < NUM_STAGES; stage++) {
+    printf("%-18s", stageNames[stage]);
+    for (size_t s = 0; s < results.size(); s++) {
+      double bytes = packets[s].length();
+      const StageTime &t = results[s][stage];
+      printf(" %8.2f %7llu", t.totalNanos / (double)iterations / bytes, (unsigned long long)t.worstCycles);
+    }
+    printf("\n");
+  }
+  return 0;
+}
@@ -0,0 +1,412 @@
+/*
+  Fuzz target for the receive path of the Uno sketch: the BluetoothLink packet parser, checksum
+  and line decoding, and the message handlers, all reached through receivedNewData() exactly as
+  loop() calls it. Each input is run once with the sketch's handlers, checked on the way in, and
+  once without, with the packets stored for getBTData() instead.
+
+  The link captures its traffic in the smallest ring, which must drain as a well formed block.
+
+  The corpus is seeded with receiveTestData, every order testAllOrders() would send, packets with
+  random lines, and the corrupted packets generated by sendCorruptData().
+
+  Build with the sanitizers and the built in mutator (from the repository root):
+    g++ -std=c++17 -O1 -g -fsanitize=address,undefined -I HostSim/include \
+        -I libraries/BluetoothLink/src HostSim/ReceivePath/ReceiveFuzz.cpp -o receive_fuzz
+    ./receive_fuzz [iterations] [seed]     run the mutator
+    ./receive_fuzz crash-file...           replay saved inputs
+
+  Or as a libFuzzer target:
+    clang++ -std=c++17 -g -fsanitize=fuzzer,address,undefined -DHOSTSIM_LIBFUZZER -I HostSim/include \
+        -I libraries/BluetoothLink/src HostSim/ReceivePath/ReceiveFuzz.cpp -o receive_fuzz
+*/
+
+#include <UnoTestFrameWorkSketch.h>
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <random>
+#include <new>
+
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/common_interface_defs.h>
+#endif
+
+#define CRASH_FILE "receive-fuzz-crash.bin"
+
+static std::string currentInput;
+
+static void saveCurrentInput() {
+  FILE *f = fopen(CRASH_FILE, "wb");
+  if (f) {
+    fwrite(currentInput.data(), 1, currentInput.size(), f);
+    fclose(f);
+    fprintf(stderr, "input written to %s\n", CRASH_FILE);
+  }
+}
+
+static void fail(const char *why) {
+  fprintf(stderr, "invariant failed: %s\n", why);
+  saveCurrentInput();
+  abort();
+}
+
+// lines passed to the last handler called
+static std::vector<std::string> handledLines;
+static unsigned long handledCount;
+
+/*
+  Checks a message on its way to the sketch's handler and keeps its lines
+*/
+static void checkMessage(const BluetoothMessage &message) {
+  handledCount++;
+  if (message.lineCount < 0 || message.lineCount > maxMessageLines) {
+    fail("line count out of range");
+  }
+  if (message.type != noMessageType && (message.type < 0 || message.type > maxMessageType)) {
+    fail("message type out of range");
+  }
+  handledLines.clear();
+  for (int i = 0; i < message.lineCount; i++) {
+    const char *line = *(message.lines + i);
+    if (strchr(line, lineEndMarker) != NULL) {
+      fail("line marker left in handled line");
+    }
+    handledLines.push_back(line);
+  }
+}
+
+static void checkedCansError(const BluetoothMessage &message) {
+  checkMessage(message);
+  if (message.type != MESSAGE_CANS_ERROR) {
+    fail("message passed to the handler of another type");
+  }
+  receivedCansError(message);
+}
+
+static void checkedUnknownMessage(const BluetoothMessage &message) {
+  checkMessage(message);
+  if (message.type == MESSAGE_CANS_ERROR && !message.truncated) {
+    fail("message with a handler passed to the fallback");
+  }
+  if (message.truncated && message.lineCount != maxMessageLines) {
+    fail("message cut short before maxMessageLines lines");
+  }
+  receivedUnknownMessage(message);
+}
+
+static const BluetoothHandler checkedHandlers[numMessageTypes] = {checkedCansError};
+
+static void resetSketch(boolean dispatch) {
+  // a new link, so no partial packet carries over from the last input
+  bluetooth.~BluetoothLink();
+  new (&bluetooth) BluetoothLink(BTSerial, connectionStatusPin);
+  if (dispatch) {
+    bluetooth.setHandlers(checkedHandlers, numMessageTypes, checkedUnknownMessage);
+  }
+  // the smallest ring, so records are dropped to make room all the time
+  bluetooth.beginCapture(captureRecordLength + 6);
+  redCansError = greenCansError = blueCansError = -1;
+  handledLines.clear();
+  handledCount = 0;
+  BTSerial.clear();
+  Serial.clear();
+}
+
+/*
+  Checks whether a packet acknowledgement, <ACK> or <NAK>, was written from the given point of the
+  output, heartbeats and their answers are written as well
+*/
+static boolean acknowledgedSince(size_t from) {
+  const std::string &output = BTSerial.output;
+  for (size_t at = output.find("<ACK", from); at != std::string::npos; at = output.find("<ACK", at + 1)) {
+    if (at + 4 >= output.size() || output[at + 4] != transferMarker) {
+      return true;
+    }
+  }
+  return output.find("<NAK", from) != std::string::npos;
+}
+
+/*
+  Runs one input through the receive path and checks what it stored or passed to the handlers
+*/
+static void runInput(const uint8_t *data, size_t size, boolean dispatch) {
+  resetSketch(dispatch);
+  BTSerial.inject(data, size);
+
+  size_t lineMarkers = 0;
+  for (size_t i = 0; i < size; i++) {
+    if (data[i] == lineStartMarker) {
+      lineMarkers++;
+    }
+  }
+
+  // every call consumes at least one byte
+  size_t calls = 0;
+  while (BTSerial.available() > 0) {
+    size_t acksBefore = BTSerial.output.size();
+    unsigned long handledBefore = handledCount;
+    unsigned long duplicatesBefore = bluetooth.getStats().duplicatePackets;
+    unsigned long staleBefore = bluetooth.getStats().stalePackets;
+    boolean received = receivedNewData();
+    boolean duplicate = bluetooth.getStats().duplicatePackets > duplicatesBefore;
+    boolean stale = bluetooth.getStats().stalePackets > staleBefore;
+
+    if (++calls > size) {
+      fail("receivedNewData() did not consume any input");
+    }
+    if (getBTDataSize() < 0 || (size_t)getBTDataSize() > lineMarkers || handledLines.size() > lineMarkers) {
+      fail("more lines stored than line markers received");
+    }
+    // every packet passed on goes to one handler, once
+    if (dispatch && handledCount != handledBefore + (received ? 1 : 0)) {
+      fail("packet passed on without a handler call, or a handler called for nothing");
+    }
+    if (dispatch && getBTDataSize() != 0) {
+      fail("packet stored while the handlers are set");
+    }
+    // a repeated or stale packet is acknowledged but not passed on
+    if ((received || duplicate || stale) != acknowledgedSince(acksBefore)) {
+      fail("acknowledgement sent for a packet that was not accepted, or missing for one that was");
+    }
+    if (received && (duplicate || stale)) {
+      fail("repeated or stale packet passed on");
+    }
+    for (int i = 0; received && i < getBTDataSize(); i++) {
+      if ((getBTData() + i)->indexOf(lineEndMarker) >= 0) {
+        fail("line marker left in stored line");
+      }
+    }
+    // the cans errors are only written by their own message
+    if (received && dispatch && handledLines.size() == 4 && handledLines[0] == "0" &&
+        redCansError != atoi(handledLines[1].c_str())) {
+      fail("cans error not written by its handler");
+    }
+  }
+
+  // the capture of it drains as one well formed block
+  Serial.clear();
+  size_t drained = drainCapture();
+  const std::string &block = Serial.output;
+  size_t length = drained < 16 ? 0 : (uint8_t)block[13] | (uint8_t)block[14] << 8;
+  if (drained != block.size() || drained != 16 + length || block.compare(0, 4, "BLCP") != 0 ||
+      BluetoothLink::CRC8((const byte *)block.data() + 15, length) != (uint8_t)block[15 + length]) {
+    fail("capture block malformed");
+  }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  currentInput.assign((const char *)data, size);
+  runInput(data, size, true);
+  runInput(data, size, false);
+  return 0;
+}
+
+#ifndef HOSTSIM_LIBFUZZER
+
+/*
+  Packets as the sketches send them, plus the corrupted ones from sendCorruptData()
+*/
+static std::vector<std::string> buildCorpus() {
+  std::vector<std::string> corpus;
+  corpus.push_back(receiveTestData.c_str());
+
+  // every valid order, as sent by testAllOrders()
+  for (int r = 0; r <= maxOneColour; r++) {
+    for (int g = 0; g <= maxOneColour; g++) {
+      for (int b = 0; b <= maxOneColour; b++) {
+        if (r + g + b <= maxCan) {
+          String order[] = {String(MESSAGE_CANS_ERROR), String(r), String(g), String(b)};
+          corpus.push_back(BluetoothLink::buildPacket(order, 4).c_str());
+          corpus.push_back(BluetoothLink::buildPacket(order, 4, PRIORITY_NORMAL, r + g + b).c_str());
+          corpus.push_back(BluetoothLink::buildPacket(order, 4, PRIORITY_URGENT, 255 - r).c_str());
+          corpus.push_back(BluetoothLink::buildPacket(order, 4, PRIORITY_NORMAL, g, true, rand()).c_str());
+        }
+      }
+    }
+  }
+
+  // heartbeats and their answers, with and without timestamps
+  corpus.push_back("<PING%7>");
+  corpus.push_back("<PONG%7>");
+  corpus.push_back("<PONG%7,1a2b3c4d,1a2b4e00>");
+  corpus.push_back("<PONG%255,ffffffff,0>");
+
+  // random printable lines without the reserved markers, checking they decode back to what was sent,
+  // stored and passed to the handlers
+  for (int n = 1; n <= 12; n++) {
+    String lines[12];
+    String expected[12];
+    for (int i = 0; i < n; i++) {
+      do {
+        lines[i] = randomString(randomValue(0, 10));
+      } while (lines[i].indexOf(lineEndMarker) >= 0 || lines[i].indexOf(packetStartMarker) >= 0 ||
+               lines[i].indexOf(packetEndMarker) >= 0);
+      expected[i] = lines[i];
+    }
+    String packet = BluetoothLink::buildPacket(lines, n);
+    corpus.push_back(packet.c_str());
+
+    for (int dispatch = 0; dispatch < 2; dispatch++) {
+      resetSketch(dispatch);
+      BTSerial.inject(packet);
+      boolean received = false;
+      while (!received && BTSerial.available() > 0) {
+        received = receivedNewData();
+      }
+      int decoded = dispatch ? handledLines.size() : getBTDataSize();
+      if (!received || decoded != n) {
+        fprintf(stderr, "seed packet rejected: %s\n", packet.c_str());
+        exit(1);
+      }
+      for (int i = 0; i < n; i++) {
+        String line = dispatch ? String(handledLines[i].c_str()) : *(getBTData() + i);
+        if (!line.equals(expected[i])) {
+          fprintf(stderr, "seed packet decoded wrongly: %s\n", packet.c_str());
+          exit(1);
+        }
+      }
+    }
+  }
+
+  // bulk transfer frames of random bytes, split back into individual frames
+  HardwareSerial transferPort;
+  BluetoothLink sender(transferPort, connectionStatusPin);
+  for (int n = 1; n <= 3; n++) {
+    byte payload[400];
+    for (int i = 0; i < n * 130; i++) {
+      payload[i] = randomValue(0, 256);
+    }
+    sender.beginTransfer(n * 130);
+    sender.write(payload, n * 130);
+    for (int i = 0; i < 100; i++) {
+      sender.update();
+    }
+    const std::string &frames = transferPort.output;
+    size_t frameStart = 0;
+    while (frameStart < frames.size()) {
+      size_t next = frames.find(packetStartMarker, frameStart + 1);
+      if (next == std::string::npos) next = frames.size();
+      corpus.push_back(frames.substr(frameStart, next - frameStart));
+      frameStart = next;
+    }
+    corpus.push_back(frames);
+    transferPort.clear();
+    sender.cancelTransfer();
+  }
+
+  // corrupted packets, split back into individual transmissions
+  resetSketch(false);
+  sendCorruptData();
+  const std::string &corrupt = BTSerial.output;
+  size_t start = 0;
+  while (start < corrupt.size()) {
+    size_t next = corrupt.find("<&", start + 1);
+    if (next == std::string::npos) next = corrupt.size();
+    corpus.push_back(corrupt.substr(start, next - start));
+    start = next;
+  }
+  return corpus;
+}
+
+static const char markers[] = {packetStartMarker, packetEndMarker, dataStartMarker, dataEndMarker,
+                               lineStartMarker, lineEndMarker, checksumStartMarker, checksumEndMarker};
+
+static std::string mutate(const std::vector<std::string> &corpus, std::mt19937 &rng) {
+  std::string s = corpus[rng() % corpus.size()];
+  int rounds = 1 + rng() % 4;
+
+  for (int r = 0; r < rounds; r++) {
+    size_t pos = s.empty() ? 0 : rng() % (s.size() + 1);
+    switch (rng() % 7) {
+      case 0:   // flip a bit
+        if (!s.empty()) s[pos % s.size()] ^= 1 << (rng() % 8);
+        break;
+      case 1:   // insert a random byte
+        s.insert(pos, 1, (char)(rng() & 0xFF));
+        break;
+      case 2:   // insert a marker
+        s.insert(pos, 1, markers[rng() % sizeof(markers)]);
+        break;
+      case 3:   // delete a run
+        if (!s.empty()) s.erase(pos % s.size(), 1 + rng() % 8);
+        break;
+      case 4:   // truncate
+        s.resize(pos);
+        break;
+      case 5: { // splice with another input
+        const std::string &other = corpus[rng() % corpus.size()];
+        s = s.substr(0, pos) + other.substr(other.empty() ? 0 : rng() % other.size());
+        break;
+      }
+      case 6:   // repeat a section, stretching lines and checksums
+        if (!s.empty()) s.insert(pos, s.substr(pos % s.size(), 1 + rng() % 32));
+        break;
+    }
+  }
+  if (s.size() > 4 * maxPacketLength) {
+    s.resize(4 * maxPacketLength);
+  }
+  return s;
+}
+
+static bool readFile(const char *path, std::string &out) {
+  FILE *f = fopen(path, "rb");
+  if (!f) return false;
+  char buf[4096];
+  size_t n;
+  out.clear();
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    out.append(buf, n);
+  }
+  fclose(f);
+  return true;
+}
+
+int main(int argc, char **argv) {
+#if defined(__SANITIZE_ADDRESS__)
+  __sanitizer_set_death_callback(saveCurrentInput);
+#endif
+
+  // replay saved inputs
+  if (argc > 1 && argv[1][0] != '-' && (argv[1][0] < '0' || argv[1][0] > '9')) {
+    for (int i = 1; i < argc; i++) {
+      std::string input;
+      if (!readFile(argv[i], input)) {
+        fprintf(stderr, "cannot read %s\n", argv[i]);
+        return 1;
+      }
+      LLVMFuzzerTestOneInput((const uint8_t *)input.data(), input.size());
+      printf("%s: ok\n", argv[i]);
+    }
+    return 0;
+  }
+
+  unsigned long iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+  uint32_t seed = argc > 2 ? atoi(argv[2]) : 1;
+  std::mt19937 rng(seed);
+
+  std::vector<std::string> corpus = buildCorpus();
+  printf("corpus: %zu seed inputs\n", corpus.size());
+
+  for (const std::string &s : corpus) {
+    LLVMFuzzerTestOneInput((const uint8_t *)s.data(), s.size());
+  }
+
+  unsigned long accepted = 0;
+  for (unsigned long i = 0; i < iterations; i++) {
+    std::string input = mutate(corpus, rng);
+    LLVMFuzzerTestOneInput((const uint8_t *)input.data(), input.size());
+    if (getBTDataSize() > 0) {
+      accepted++;
+      // inputs that still decode make good starting points
+      if (corpus.size() < 4096) {
+        corpus.push_back(input);
+      }
+    }
+  }
+  printf("%lu inputs, %lu decoded, no failures\n", iterations, accepted);
+  return 0;
+}
+
+#endif
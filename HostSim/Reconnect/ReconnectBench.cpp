@@ -0,0 +1,189 @@
+/*
+  Link quality estimates and recovery from lost connections through two emulated HM-10 modules.
+
+  The Uno's module is the central (role 1) with the Mega's module's address as its peer MAC, the
+  Mega's is the peripheral. They start connected. The Uno sends a telemetry packet every
+  packetMillis; the Mega only answers. After warmupMillis the connection is lost:
+    lost         the modules drop the connection and both print OK+LOST
+    range Ns     out of range for N seconds, OK+LOST when the connection drops
+    silent       the connection drops without OK+LOST, e.g. the other module lost power
+    quiet Ns     the Mega's sketch stops for N seconds, the modules stay connected
+  and both links must find out, the Uno's reconnect in the background, and telemetry carry on.
+  A quiet link must come back without AT+CON, which the connected module would send to the Mega
+  as data; the run fails if the Uno sends one.
+
+  Reports the round trip and loss the Mega, which has nothing else to send, estimated from its
+  heartbeats before the loss, and the time from
+  the loss to the Uno's link reporting it (detect), to it being up again (up), and to the Mega
+  receiving the first packet the Uno queued after the loss (data), with the AT+CON attempts it
+  took. Time is simulated: one pass of loop() costs loopMicros.
+
+  Build (from the repository root):
+    g++ -std=c++17 -O2 -I HostSim/include -I libraries/BluetoothLink/src \
+        HostSim/Reconnect/ReconnectBench.cpp -o reconnect_bench
+    ./reconnect_bench [loopMicros]
+*/
+
+#include <Arduino.h>
+#include <HM10.h>
+#include <BluetoothLinkSources.h>
+
+#include <stdio.h>
+
+#define warmupMillis      20000
+#define packetMillis      200
+#define runTimeout        60      // simulated seconds after the loss before a run is failed
+#define UNO_STATE_PIN     2
+#define MEGA_STATE_PIN    3
+
+enum Loss { LOSS_LOST, LOSS_RANGE, LOSS_SILENT, LOSS_QUIET };
+
+/*
+  Result of one run, times in ms from the loss
+*/
+struct Run {
+  BluetoothLinkQuality quality;   // of the Mega, at the loss
+  double detect;
+  double up;
+  double data;
+  unsigned long attempts;         // AT+CON sent by the Uno
+  unsigned long failures;         // packets the Uno gave up on
+};
+
+static double millisSince(uint64_t from) {
+  return (HostSim::clockMicros - from) / 1000.0;
+}
+
+static Run run(unsigned long baud, unsigned long loopMicros, Loss loss, unsigned long lossMillis) {
+  HardwareSerial unoPort, megaPort;
+  HM10 unoModule("A81B6AAE5221"), megaModule("D43639BB7C3E");
+  unoModule.role = 1;
+  unoModule.statePin = UNO_STATE_PIN;
+  megaModule.statePin = MEGA_STATE_PIN;
+  unoModule.attach(unoPort, baud);
+  megaModule.attach(megaPort, baud);
+  HM10::pair(unoModule, megaModule);
+  unoModule.connected = true;
+  megaModule.connected = true;
+
+  BluetoothLink uno(unoPort, UNO_STATE_PIN);
+  BluetoothLink mega(megaPort, MEGA_STATE_PIN);
+  uno.setPeerMAC(String(megaModule.address.c_str()));
+
+  HostSim::clockMicros = 0;
+  Run result;
+  memset(&result, 0, sizeof(result));
+  result.detect = result.up = result.data = -1;
+
+  uint64_t lossTime = (uint64_t)warmupMillis * 1000;
+  uint64_t backInRange = 0;
+  uint64_t megaResumes = 0;
+  boolean lost = false;
+  unsigned long attemptsBefore = 0;
+  unsigned long packetNumber = 0;
+  unsigned long firstAfterLoss = 0;
+  uint64_t nextPacket = 0;
+
+  while (result.data < 0 || result.up < 0) {
+    if (lost && HostSim::clockMicros - lossTime > (uint64_t)runTimeout * 1000000) {
+      fprintf(stderr, "no data %d s after the loss at %lu baud\n", runTimeout, baud);
+      exit(1);
+    }
+
+    if (!lost && HostSim::clockMicros >= lossTime) {
+      lost = true;
+      result.quality = mega.getLinkQuality();
+      attemptsBefore = uno.getLinkQuality().reconnectAttempts;
+      firstAfterLoss = packetNumber;
+      if (loss == LOSS_LOST) {
+        unoModule.disconnect();
+      } else if (loss == LOSS_RANGE) {
+        unoModule.setInRange(false);
+        backInRange = HostSim::clockMicros + (uint64_t)lossMillis * 1000;
+      } else if (loss == LOSS_SILENT) {
+        unoModule.disconnect(true);
+      } else {
+        megaResumes = HostSim::clockMicros + (uint64_t)lossMillis * 1000;
+      }
+    }
+    if (backInRange != 0 && HostSim::clockMicros >= backInRange) {
+      unoModule.setInRange(true);
+      backInRange = 0;
+    }
+
+    unoModule.poll();
+    megaModule.poll();
+
+    // Uno loop()
+    if (HostSim::clockMicros >= nextPacket && !uno.isSending(PRIORITY_NORMAL)) {
+      String lines[] = {"TEL", String(packetNumber), "0123456789012345678901234567890123456789"};
+      if (uno.send(lines, 3, PRIORITY_NORMAL)) {
+        packetNumber++;
+      }
+      nextPacket = HostSim::clockMicros + (uint64_t)packetMillis * 1000;
+    }
+    uno.update();
+    if (lost && result.detect < 0 && !uno.isLinkUp()) {
+      result.detect = millisSince(lossTime);
+    }
+    if (lost && result.detect >= 0 && result.up < 0 && uno.isLinkUp()) {
+      result.up = millisSince(lossTime);
+    }
+
+    // Mega loop()
+    if (HostSim::clockMicros >= megaResumes) {
+      mega.update();
+      if (mega.receivedNewData() && lost && result.data < 0 &&
+          (unsigned long)(mega.getData() + 1)->toInt() >= firstAfterLoss) {
+        result.data = millisSince(lossTime);
+      }
+    }
+
+    HostSim::advance(loopMicros);
+  }
+
+  result.attempts = uno.getLinkQuality().reconnectAttempts - attemptsBefore;
+  result.failures = uno.getStats().sendFailures;
+  if (loss == LOSS_QUIET && result.attempts > 0) {
+    fprintf(stderr, "AT+CON sent to the connected module at %lu baud\n", baud);
+    exit(1);
+  }
+  return result;
+}
+
+int main(int argc, char **argv) {
+  unsigned long loopMicros = argc > 1 ? strtoul(argv[1], NULL, 10) : 200;
+
+  // time only moves when the simulated loop says so
+  HostSim::busyWaitMicros = 0;
+
+  unsigned long bauds[] = {9600, 38400, 115200};
+  struct {
+    const char *name;
+    Loss loss;
+    unsigned long lossMillis;
+  } losses[] = {
+    {"lost", LOSS_LOST, 0},
+    {"range 1s", LOSS_RANGE, 1000},
+    {"range 5s", LOSS_RANGE, 5000},
+    {"silent", LOSS_SILENT, 0},
+    {"quiet 5s", LOSS_QUIET, 5000},
+  };
+
+  printf("loop pass %lu us, telemetry every %d ms, heartbeat after %d ms idle, link timeout %d ms\n",
+         loopMicros, packetMillis, heartbeatInterval, linkTimeout);
+  printf("rtt and loss from the idle Mega's heartbeats over the first %d ms, times in ms from the loss\n\n",
+         warmupMillis);
+  printf("%7s %9s | %8s %8s %6s %5s | %8s %8s %8s %8s %8s\n", "baud", "loss", "rtt", "rttvar",
+         "loss %", "hb", "detect", "up", "data", "AT+CON", "failed");
+
+  for (unsigned long baud : bauds) {
+    for (auto &loss : losses) {
+      Run r = run(baud, loopMicros, loss.loss, loss.lossMillis);
+      printf("%7lu %9s | %8.1f %8.1f %6u %5lu | %8.0f %8.0f %8.0f %8lu %8lu\n", baud, loss.name,
+             r.quality.rtt / 1000.0, r.quality.rttVariation / 1000.0, r.quality.lossPercent,
+             r.quality.heartbeatsSent, r.detect, r.up, r.data, r.attempts, r.failures);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,499 @@
+/*
+  Replays a capture drained from a board with drainCapture() through the receive path.
+
+  The dump is the raw bytes read from the board's debug port: the capture blocks are found by
+  their "BLCP" and checked against their CRC8, and any text between them is skipped. The bytes
+  the board read from the Bluetooth Serial are fed to a BluetoothLink built for the host, which
+  captures what it makes of each packet as the board did. Any packet it decides differently, e.g.
+  passes on one the board found a duplicate of, is a divergence.
+
+  At recorded speed (the default) each read arrives at the time it was recorded, and update() is
+  called every loopMicros in between, so timeouts fire as they did on the board. With --max every
+  byte is there at once and update() is called until all have been read, with the clock stopped.
+
+  Reports, for each packet (frame) received, the time from the read of its first byte to the
+  decision on it, on the board and in the replay, and the host time the replay's update() calls
+  that read its bytes took. -v lists every frame.
+
+  --generate writes a capture to replay: the Mega's side of a session with the Uno over a noisy
+  link, the Uno sending telemetry and the odd urgent command, with the Mega's capture drained
+  every drainMillis between lines of text, as drainCapture() would be on the board. Its replay
+  should not diverge.
+
+  Build (from the repository root):
+    g++ -std=c++17 -O2 -I HostSim/include -I libraries/BluetoothLink/src \
+        HostSim/Replay/CaptureReplay.cpp -o capture_replay
+    ./capture_replay --generate capture.bin [seconds] [seed]
+    ./capture_replay capture.bin [--max] [-v] [loopMicros]
+*/
+
+#include <Arduino.h>
+#include <BluetoothLinkSources.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define baudRate          9600
+#define statePin          3
+#define captureRingSize   4096
+#define drainMillis       1000
+#define packetMillis      100
+#define urgentMillis      1500
+#define corruptOdds       1500    // one byte in this many has a bit flipped
+#define lossOdds          1500    // one byte in this many is lost
+#define blockHeaderLength 15
+#define shownDivergences  10
+
+/*
+  One record of a capture, at its time on the board's micros() made 64 bits
+*/
+struct Record {
+  byte type;
+  uint64_t micros;
+  std::string data;
+};
+
+/*
+  What a link made of one frame
+*/
+struct Frame {
+  char event;
+  uint64_t decided;
+  double latency;     // us from the read of the first byte
+  double hostNanos;   // replay only
+};
+
+struct Capture {
+  std::vector<Record> records;
+  unsigned long blocks = 0;
+  unsigned long badBlocks = 0;
+  unsigned long dropped = 0;
+};
+
+/*
+  Collects what is written to it, for the replay's own capture
+*/
+class StringPrint : public Print {
+  public:
+    std::string text;
+    size_t write(uint8_t b) override {
+      text += (char)b;
+      return 1;
+    }
+    using Print::write;
+};
+
+static uint32_t readLE(const std::string &s, size_t at, int bytes) {
+  uint32_t value = 0;
+  for (int i = bytes - 1; i >= 0; i--) {
+    value = (value << 8) | (uint8_t)s[at + i];
+  }
+  return value;
+}
+
+/*
+  Reads one record, false if it runs past the end of the block
+*/
+static bool readRecord(const std::string &s, size_t &at, size_t end, Record &r, uint32_t &delta) {
+  if (at >= end) return false;
+  byte header = s[at++];
+  r.type = header >> 6;
+  size_t length = (header & 0x3F) + 1;
+  delta = 0;
+  for (int shift = 0; ; shift += 7) {
+    if (at >= end || shift > 28) return false;
+    byte b = s[at++];
+    delta |= (uint32_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) break;
+  }
+  if (at + length > end) return false;
+  r.data = s.substr(at, length);
+  at += length;
+  return true;
+}
+
+/*
+  Finds the capture blocks in a dump and appends their records, continuing the times from the
+  last record in 'capture'
+*/
+static void parseDump(const std::string &dump, Capture &capture) {
+  size_t at = 0;
+  while ((at = dump.find("BLCP", at)) != std::string::npos) {
+    if (at + blockHeaderLength > dump.size() || (uint8_t)dump[at + 4] != captureVersion) {
+      at++;
+      continue;
+    }
+    uint32_t tail = readLE(dump, at + 5, 4);
+    uint32_t dropped = readLE(dump, at + 9, 4);
+    size_t length = readLE(dump, at + 13, 2);
+    size_t start = at + blockHeaderLength;
+    if (start + length + 1 > dump.size() ||
+        BluetoothLink::CRC8((const byte *)dump.data() + start, length) != (uint8_t)dump[start + length]) {
+      capture.badBlocks++;
+      at++;
+      continue;
+    }
+
+    // 32 bit micros() made 64 bits, taking the block to start after the last record
+    uint64_t time = tail;
+    if (!capture.records.empty()) {
+      uint64_t last = capture.records.back().micros;
+      time = last + (uint32_t)(tail - (uint32_t)last);
+    }
+    size_t p = start;
+    bool first = true;
+    Record r;
+    uint32_t delta;
+    while (readRecord(dump, p, start + length, r, delta)) {
+      if (!first) time += delta;
+      first = false;
+      r.micros = time;
+      capture.records.push_back(r);
+    }
+    capture.blocks++;
+    capture.dropped += dropped;
+    at = start + length + 1;
+  }
+}
+
+/*
+  The frames in a capture, timed from the read of their start marker to the event
+*/
+static std::vector<Frame> framesOf(const std::vector<Record> &records) {
+  std::vector<Frame> frames;
+  bool open = false;
+  uint64_t start = 0;
+  for (const Record &r : records) {
+    if (r.type == CAPTURE_RX) {
+      if (!open && r.data.find(packetStartMarker) != std::string::npos) {
+        open = true;
+        start = r.micros;
+      }
+    } else if (r.type == CAPTURE_EVENT) {
+      Frame f;
+      f.event = r.data[0];
+      f.decided = r.micros;
+      f.latency = open ? (double)(r.micros - start) : 0;
+      f.hostNanos = 0;
+      frames.push_back(f);
+      open = false;
+    }
+  }
+  return frames;
+}
+
+
+/************************************************************************************************************************/
+/************************/
+/*      Replay          */
+/************************/
+/************************************************************************************************************************/
+
+/*
+  The link being replayed into, its update() timed on the host and its capture kept
+*/
+struct Replay {
+  HardwareSerial port;
+  BluetoothLink link;
+  StringPrint sink;
+  Capture capture;
+  double pendingNanos = 0;    // time of the update() calls that read bytes since the last event
+  std::vector<double> eventNanos;
+  double totalNanos = 0;
+  unsigned long updates = 0;
+
+  Replay() : link(port, statePin) {
+    link.beginCapture(0xFFFF);
+  }
+
+  void update() {
+    // idle passes are not part of decoding a frame
+    bool reading = port.available() > 0;
+    auto begin = std::chrono::steady_clock::now();
+    link.update();
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+    link.receivedNewData();
+    totalNanos += ns;
+    if (reading) {
+      pendingNanos += ns;
+    }
+    updates++;
+
+    sink.text.clear();
+    link.drainCapture(sink);
+    size_t before = capture.records.size();
+    parseDump(sink.text, capture);
+    for (size_t i = before; i < capture.records.size(); i++) {
+      if (capture.records[i].type == CAPTURE_EVENT) {
+        eventNanos.push_back(pendingNanos);
+        pendingNanos = 0;
+      }
+    }
+  }
+};
+
+static double mean(const std::vector<double> &v) {
+  double total = 0;
+  for (double x : v) total += x;
+  return v.empty() ? 0 : total / v.size();
+}
+
+static double largest(const std::vector<double> &v) {
+  double m = 0;
+  for (double x : v) m = x > m ? x : m;
+  return m;
+}
+
+static int replay(const char *path, bool maxSpeed, bool verbose, unsigned long loopMicros) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    fprintf(stderr, "cannot read %s\n", path);
+    return 2;
+  }
+  std::stringstream dump;
+  dump << in.rdbuf();
+
+  Capture recorded;
+  parseDump(dump.str(), recorded);
+  if (recorded.records.empty()) {
+    fprintf(stderr, "no capture blocks in %s\n", path);
+    return 2;
+  }
+  uint64_t first = recorded.records.front().micros;
+  uint64_t last = recorded.records.back().micros;
+  unsigned long rxBytes = 0, txBytes = 0;
+  for (const Record &r : recorded.records) {
+    if (r.type == CAPTURE_RX) rxBytes += r.data.size();
+    if (r.type == CAPTURE_TX) txBytes += r.data.size();
+  }
+  printf("%s: %lu blocks, %lu failed their CRC, %lu bytes of records dropped\n", path, recorded.blocks,
+         recorded.badBlocks, recorded.dropped);
+  printf("%zu records over %.3f s, %lu bytes read, %lu written\n", recorded.records.size(),
+         (last - first) / 1e6, rxBytes, txBytes);
+  if (recorded.dropped > 0 || recorded.badBlocks > 0) {
+    printf("records are missing, the replay may diverge after them\n");
+  }
+
+  // the link starts as the board's did when it began capturing
+  HostSim::busyWaitMicros = 0;
+  HostSim::clockMicros = first;
+  Replay rp;
+
+  if (maxSpeed) {
+    for (const Record &r : recorded.records) {
+      if (r.type == CAPTURE_RX) {
+        rp.port.inject((const uint8_t *)r.data.data(), r.data.size());
+      }
+    }
+    while (rp.port.available() > 0) {
+      rp.update();
+    }
+    rp.update();
+  } else {
+    for (const Record &r : recorded.records) {
+      if (r.type != CAPTURE_RX) continue;
+      while (HostSim::clockMicros + loopMicros < r.micros) {
+        HostSim::advance(loopMicros);
+        rp.update();
+      }
+      HostSim::clockMicros = r.micros;
+      rp.port.inject((const uint8_t *)r.data.data(), r.data.size());
+      while (rp.port.available() > 0) {
+        rp.update();
+      }
+    }
+    // let a partial packet at the end time out as it would have
+    uint64_t end = HostSim::clockMicros + (uint64_t)packetTimeout * 1000 + loopMicros;
+    while (HostSim::clockMicros < end) {
+      HostSim::advance(loopMicros);
+      rp.update();
+    }
+  }
+
+  std::vector<Frame> was = framesOf(recorded.records);
+  std::vector<Frame> now = framesOf(rp.capture.records);
+  for (size_t i = 0; i < now.size() && i < rp.eventNanos.size(); i++) {
+    now[i].hostNanos = rp.eventNanos[i];
+  }
+  // events the board made after its capture ended are not divergences
+  if (now.size() > was.size()) {
+    now.resize(was.size());
+  }
+
+  unsigned long divergences = 0;
+  std::vector<double> recordedLatency, replayLatency, hostNanos;
+  if (verbose) {
+    printf("\n%6s %12s %5s %5s %12s %12s %10s\n", "frame", "time s", "was", "now", "board us", "replay us",
+           "host ns");
+  }
+  for (size_t i = 0; i < was.size(); i++) {
+    const Frame &w = was[i];
+    bool replayed = i < now.size();
+    bool diverged = !replayed || now[i].event != w.event;
+    recordedLatency.push_back(w.latency);
+    if (replayed) {
+      replayLatency.push_back(now[i].latency);
+      hostNanos.push_back(now[i].hostNanos);
+    }
+    if (diverged) {
+      divergences++;
+    }
+    if (verbose || (diverged && divergences <= shownDivergences)) {
+      printf("%6zu %12.6f %5c %5c %12.0f %12.0f %10.0f%s\n", i, (w.decided - first) / 1e6, w.event,
+             replayed ? now[i].event : '-', w.latency, replayed ? now[i].latency : 0,
+             replayed ? now[i].hostNanos : 0, diverged ? "  diverged" : "");
+    }
+  }
+
+  const char events[] = {EVENT_PASSED, EVENT_DUPLICATE, EVENT_STALE, EVENT_CHECKSUM, EVENT_DROPPED,
+                         EVENT_ACK, EVENT_HEARTBEAT, EVENT_TRANSFER};
+  printf("\nreplayed at %s, %lu update() calls\n", maxSpeed ? "maximum speed" : "recorded speed", rp.updates);
+  printf("%10s", "frames");
+  for (char e : events) printf(" %6c", e);
+  printf("\n%10s", "board");
+  for (char e : events) {
+    unsigned long n = 0;
+    for (const Frame &f : was) n += f.event == e;
+    printf(" %6lu", n);
+  }
+  printf("\n%10s", "replay");
+  for (char e : events) {
+    unsigned long n = 0;
+    for (const Frame &f : now) n += f.event == e;
+    printf(" %6lu", n);
+  }
+  printf("\n\ndecode latency, read of the first byte to the decision, us: board mean %.0f worst %.0f",
+         mean(recordedLatency), largest(recordedLatency));
+  if (!maxSpeed) {
+    printf(", replay mean %.0f worst %.0f", mean(replayLatency), largest(replayLatency));
+  }
+  printf("\nhost update() time per frame, ns: mean %.0f worst %.0f; %.1f MB/s read\n", mean(hostNanos),
+         largest(hostNanos), rp.totalNanos > 0 ? rxBytes * 1e3 / rp.totalNanos : 0);
+  printf("%lu of %zu frames diverged\n", divergences, was.size());
+  return divergences == 0 ? 0 : 1;
+}
+
+
+/************************************************************************************************************************/
+/************************/
+/*      Generate        */
+/************************/
+/************************************************************************************************************************/
+
+/*
+  Moves the bytes that have crossed the link on to the other port, flipping a bit in or losing
+  the odd one
+*/
+static void carry(HardwareSerial &wire, HardwareSerial &to) {
+  while (wire.available() > 0) {
+    uint8_t b = wire.read();
+    if (rand() % lossOdds == 0) {
+      continue;
+    }
+    if (rand() % corruptOdds == 0) {
+      b ^= 1 << (rand() % 8);
+    }
+    to.inject(&b, 1);
+  }
+}
+
+static int generate(const char *path, unsigned long seconds, unsigned long seed, unsigned long loopMicros) {
+  srand(seed);
+  HostSim::busyWaitMicros = 0;
+  HostSim::clockMicros = 0;
+
+  // each port writes into a wire, whose bytes are carried to the other port with the noise
+  HardwareSerial unoPort, megaPort, unoWire, megaWire, megaDebug;
+  unoPort.peer = &unoWire;
+  megaPort.peer = &megaWire;
+  unoPort.baud = baudRate;
+  megaPort.baud = baudRate;
+
+  BluetoothLink uno(unoPort, 2);
+  BluetoothLink mega(megaPort, statePin);
+  uno.timestampPackets = true;
+  mega.beginCapture(captureRingSize);
+
+  unsigned long packetNumber = 0, received = 0;
+  uint64_t nextPacket = 0, nextUrgent = (uint64_t)urgentMillis * 1000, nextDrain = (uint64_t)drainMillis * 1000;
+  uint64_t end = (uint64_t)seconds * 1000000;
+
+  while (HostSim::clockMicros < end) {
+    carry(unoWire, megaPort);
+    carry(megaWire, unoPort);
+
+    // Uno loop()
+    if (HostSim::clockMicros >= nextPacket && !uno.isSending(PRIORITY_NORMAL)) {
+      String lines[] = {"TEL", String(packetNumber), String(analogRead(0)), String(analogRead(1))};
+      if (uno.send(lines, 4, PRIORITY_NORMAL)) {
+        packetNumber++;
+      }
+      nextPacket = HostSim::clockMicros + (uint64_t)packetMillis * 1000;
+    }
+    if (HostSim::clockMicros >= nextUrgent && !uno.isSending(PRIORITY_URGENT)) {
+      String lines[] = {"STOP"};
+      uno.send(lines, 1, PRIORITY_URGENT);
+      nextUrgent = HostSim::clockMicros + (uint64_t)urgentMillis * 1000;
+    }
+    uno.update();
+    uno.receivedNewData();
+
+    // Mega loop()
+    mega.update();
+    if (mega.receivedNewData()) {
+      received++;
+    }
+    if (HostSim::clockMicros >= nextDrain) {
+      megaDebug.print("Received " + String(received) + " packets\n");
+      mega.drainCapture(megaDebug);
+      megaDebug.print("\n");
+      nextDrain += (uint64_t)drainMillis * 1000;
+    }
+
+    HostSim::advance(loopMicros);
+  }
+  mega.drainCapture(megaDebug);
+
+  std::ofstream out(path, std::ios::binary);
+  out.write(megaDebug.output.data(), megaDebug.output.size());
+  if (!out) {
+    fprintf(stderr, "cannot write %s\n", path);
+    return 2;
+  }
+  const BluetoothLinkStats &stats = mega.getStats();
+  printf("%s: %lu simulated seconds at %d baud, %zu bytes, Uno sent %lu packets, Mega passed on %lu, "
+         "%lu duplicates, %lu failed their checksum\n", path, seconds, baudRate, megaDebug.output.size(),
+         packetNumber, received, stats.duplicatePackets, stats.checksumErrors);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 2 && strcmp(argv[1], "--generate") == 0) {
+    unsigned long seconds = argc > 3 ? strtoul(argv[3], NULL, 10) : 30;
+    unsigned long seed = argc > 4 ? strtoul(argv[4], NULL, 10) : 1;
+    return generate(argv[2], seconds, seed, 200);
+  }
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s --generate capture.bin [seconds] [seed]\n"
+                    "       %s capture.bin [--max] [-v] [loopMicros]\n", argv[0], argv[0]);
+    return 2;
+  }
+
+  bool maxSpeed = false, verbose = false;
+  unsigned long loopMicros = 200;
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--max") == 0) {
+      maxSpeed = true;
+    } else if (strcmp(argv[i], "-v") == 0) {
+      verbose = true;
+    } else {
+      loopMicros = strtoul(argv[i], NULL, 10);
+    }
+  }
+  return replay(argv[1], maxSpeed, verbose, loopMicros ? loopMicros : 1);
+}
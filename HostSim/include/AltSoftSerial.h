@@ -0,0 +1,18 @@
+/*
+  Host stand-in for AltSoftSerial used when building the Uno sketches.
+  Behaves as a HardwareSerial port; the bit-level library itself is exercised by AltSoftSerialSim.
+*/
+
+#ifndef HostSim_AltSoftSerial_h
+#define HostSim_AltSoftSerial_h
+
+#include "Arduino.h"
+
+class AltSoftSerial : public HardwareSerial {
+  public:
+    AltSoftSerial() { }
+    AltSoftSerial(uint8_t rxPin, uint8_t txPin, bool inverse = false) { (void)rxPin; (void)txPin; (void)inverse; }
+    bool overflow() { return false; }
+};
+
+#endif
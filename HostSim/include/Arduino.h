@@ -0,0 +1,146 @@
+/*
+  Minimal Arduino core for building the Bluetooth sketches and libraries on a Linux host.
+  Only the parts of the core that this repository uses are provided.
+
+  Time is simulated. Every call to millis() or micros() charges HostSim::busyWaitMicros to the
+  clock so that the sketches' polling loops (timeouts, AT responses) run to completion instantly.
+  millis() and micros() read the clock of the board whose loop() is running: a test program with
+  two boards sets HostSim::boardOffsetMicros and boardSkewPpm before each, the serial ports and
+  modules keep to the simulated clock itself. HostSim::background, if set, is called whenever a
+  sketch moves the clock, so emulated modules answer while the sketch waits for them.
+*/
+
+#ifndef HostSim_Arduino_h
+#define HostSim_Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "WString.h"
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH          0x1
+#define LOW           0x0
+
+#define INPUT         0x0
+#define OUTPUT        0x1
+#define INPUT_PULLUP  0x2
+
+#define DEC 10
+#define HEX 16
+
+#define NUM_HOST_PINS 70
+
+namespace HostSim {
+  inline uint64_t clockMicros = 0;
+  inline uint32_t busyWaitMicros = 1;
+  inline uint8_t pinLevel[NUM_HOST_PINS];
+
+  inline int64_t boardOffsetMicros = 0;
+  inline double boardSkewPpm = 0;
+
+  inline void (*background)() = nullptr;
+
+  inline void advance(uint64_t us) { clockMicros += us; }
+
+  // time passed inside the sketch
+  inline void spend(uint64_t us) {
+    static bool running = false;
+    clockMicros += us;
+    if (background && !running) {
+      running = true;
+      background();
+      running = false;
+    }
+  }
+
+  // the running board's clock, 32 bits as on the boards when it is not the simulated clock
+  inline uint64_t boardMicros() {
+    if (boardOffsetMicros == 0 && boardSkewPpm == 0) return clockMicros;
+    return (uint32_t)(boardOffsetMicros + (int64_t)(clockMicros * (1 + boardSkewPpm / 1e6)));
+  }
+}
+
+inline unsigned long micros() {
+  HostSim::spend(HostSim::busyWaitMicros);
+  return (unsigned long)HostSim::boardMicros();
+}
+inline unsigned long millis() {
+  HostSim::spend(HostSim::busyWaitMicros);
+  return (unsigned long)(HostSim::boardMicros() / 1000);
+}
+inline void delay(unsigned long ms) { HostSim::spend((uint64_t)ms * 1000); }
+inline void delayMicroseconds(unsigned int us) { HostSim::spend(us); }
+
+inline void pinMode(uint8_t pin, uint8_t mode) { (void)pin; (void)mode; }
+inline void digitalWrite(uint8_t pin, uint8_t val) { if (pin < NUM_HOST_PINS) HostSim::pinLevel[pin] = val; }
+inline int digitalRead(uint8_t pin) { return pin < NUM_HOST_PINS ? HostSim::pinLevel[pin] : LOW; }
+inline int analogRead(uint8_t pin) { (void)pin; return rand() & 0x3FF; }
+
+inline void randomSeed(unsigned long seed) { if (seed) srand(seed); }
+inline long random(long howbig) { return howbig ? rand() % howbig : 0; }
+inline long random(long howsmall, long howbig) {
+  return howsmall >= howbig ? howsmall : howsmall + random(howbig - howsmall);
+}
+
+
+/************************************************************************************************************************/
+/************************/
+/*    Print / Stream    */
+/************************/
+/************************************************************************************************************************/
+
+class Print {
+  public:
+    virtual ~Print() { }
+    virtual size_t write(uint8_t b) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+      size_t n = 0;
+      while (size--) {
+        n += write(*buffer++);
+      }
+      return n;
+    }
+    size_t write(const char *str) {
+      return write((const uint8_t *)str, strlen(str));
+    }
+    size_t write(const char *buffer, size_t size) {
+      return write((const uint8_t *)buffer, size);
+    }
+
+    // default to zero, meaning "a single write may block"
+    virtual int availableForWrite() { return 0; }
+
+    size_t print(const String &s) { return write(s.c_str(), s.length()); }
+    size_t print(const char *str) { return write(str); }
+    size_t print(const __FlashStringHelper *str) { return write(reinterpret_cast<const char *>(str)); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char n, int base = DEC) { return print(String(n, base)); }
+    size_t print(int n, int base = DEC) { return print(String(n, base)); }
+    size_t print(unsigned int n, int base = DEC) { return print(String(n, base)); }
+    size_t print(long n, int base = DEC) { return print(String(n, base)); }
+    size_t print(unsigned long n, int base = DEC) { return print(String(n, base)); }
+
+    size_t println() { return write("\r\n"); }
+    template <typename T> size_t println(const T &value) { return print(value) + println(); }
+    template <typename T> size_t println(const T &value, int base) { return print(value, base) + println(); }
+};
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() { }
+};
+
+#include "HardwareSerial.h"
+
+#endif
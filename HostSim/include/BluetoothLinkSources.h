@@ -0,0 +1,18 @@
+/*
+  The BluetoothLink library's sources, compiled into the test program that includes this as the
+  Arduino IDE would compile them alongside the sketch. A new source file is added here only.
+*/
+
+#ifndef HostSim_BluetoothLinkSources_h
+#define HostSim_BluetoothLinkSources_h
+
+#include <Arduino.h>
+#include "../../libraries/BluetoothLink/src/BluetoothLink.cpp"
+#include "../../libraries/BluetoothLink/src/BluetoothLinkTransfer.cpp"
+#include "../../libraries/BluetoothLink/src/BluetoothLinkQuality.cpp"
+#include "../../libraries/BluetoothLink/src/BluetoothLinkClock.cpp"
+#include "../../libraries/BluetoothLink/src/BluetoothLinkCapture.cpp"
+#include "../../libraries/BluetoothLink/src/BluetoothLinkPairing.cpp"
+#include "../../libraries/BluetoothLink/src/BluetoothLinkDispatch.cpp"
+
+#endif
@@ -0,0 +1,37 @@
+/*
+  Host EEPROM, the size of the Uno's. Writes take writeMicros on the simulated clock, as a byte
+  does on the ATmega, and are counted. The contents last until erase(), across the links and
+  modules a test program makes, as they would across power cycles.
+*/
+
+#ifndef HostSim_EEPROM_h
+#define HostSim_EEPROM_h
+
+#include <Arduino.h>
+
+class EEPROMClass {
+  public:
+    uint8_t data[1024];
+    uint64_t writeMicros = 3300;
+    unsigned long bytesWritten = 0;
+
+    EEPROMClass() { erase(); }
+
+    uint8_t read(int idx) { return data[idx]; }
+    void write(int idx, uint8_t val) {
+      HostSim::spend(writeMicros);
+      data[idx] = val;
+      bytesWritten++;
+    }
+    void update(int idx, uint8_t val) {
+      if (data[idx] != val) write(idx, val);
+    }
+    uint16_t length() { return sizeof(data); }
+
+    // as shipped, every byte 0xFF
+    void erase() { memset(data, 0xFF, sizeof(data)); }
+};
+
+inline EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,207 @@
+/*
+  Host HM-10 BLE module. Sits between a sketch's Serial port and the module it is paired with.
+
+  Connect a module to the sketch's port with attach(), and the two modules with pair(). poll()
+  must be called on every pass of the simulated loop. While connected, bytes from the sketch are
+  forwarded to the other module's sketch after airLatencyMicros, plus up to airJitterMicros;
+  while not connected they are read as AT commands, answered once the sketch has stopped writing
+  for commandGapMicros.
+
+  AT, AT+CON<mac>, AT+ROLE?, AT+ROLE<n>, AT+NAME?, AT+NAME<name>, AT+ADDR? and AT+RADD? are
+  answered as the HM-10 does. A central (role 1) connects to the peripheral (role 0) whose address it is given,
+  if it is in range, after connectMicros; otherwise OK+CONNF is answered after connectTimeoutMicros.
+  Both modules print OK+CONN when connected, and OK+LOST when the connection is lost with
+  disconnect() or by going out of range. The STATE pin is HIGH while connected and blinks every
+  500 ms while not. restart() power cycles the module, which keeps its role and name.
+*/
+
+#ifndef HostSim_HM10_h
+#define HostSim_HM10_h
+
+#include <Arduino.h>
+#include <deque>
+#include <string>
+#include <utility>
+
+class HM10 {
+  public:
+    HardwareSerial uart;              // the module's side of the sketch's Serial
+    std::string name = "HMSoft";
+    std::string address;              // 12 hex digits
+    int role = 0;                     // 0 peripheral, 1 central
+    int statePin = -1;                // pin the sketch reads STATE from, -1 if none
+    std::string lastPeer = "000000000000";  // last module connected to, for AT+RADD?, kept by restart()
+
+    uint64_t airLatencyMicros = 15000;  // for bytes sent by this module
+    uint64_t airJitterMicros = 0;       // up to this much more, at random, keeping the bytes in order
+    uint64_t commandGapMicros = 20000;
+    uint64_t connectMicros = 400000;
+    uint64_t connectTimeoutMicros = 10000000;
+
+    HM10 *other = nullptr;            // module it can connect to
+    bool inRange = true;              // shared with 'other' by setInRange()
+    bool connected = false;
+
+    unsigned long commands = 0;       // AT commands answered
+    unsigned long writes = 0;         // AT commands that changed a setting
+
+    HM10(const std::string &address) : address(address) {
+      // the module's own buffers never hold up the simulated clock
+      uart.txBufferSize = 1 << 16;
+    }
+
+    /*
+      Wires the module to the sketch's Serial port at the given baud rate
+    */
+    void attach(HardwareSerial &sketchPort, unsigned long baud) {
+      sketchPort.peer = &uart;
+      uart.peer = &sketchPort;
+      sketchPort.baud = baud;
+      uart.baud = baud;
+    }
+
+    static void pair(HM10 &a, HM10 &b) {
+      a.other = &b;
+      b.other = &a;
+    }
+
+    /*
+      Drops the connection. Both modules print OK+LOST unless 'silent', e.g. when the other
+      module has lost power.
+    */
+    void disconnect(bool silent = false) {
+      if (!connected) return;
+      connected = false;
+      air.clear();
+      if (!silent) reply("OK+LOST");
+      if (other && other->connected) {
+        other->connected = false;
+        other->air.clear();
+        if (!silent) other->reply("OK+LOST");
+      }
+    }
+
+    /*
+      Power cycles the module: the connection is dropped without OK+LOST on this side, anything
+      part way is forgotten, the settings are kept as in the module's flash
+    */
+    void restart() {
+      if (connected && other && other->connected) {
+        other->connected = false;
+        other->air.clear();
+        other->reply("OK+LOST");
+      }
+      connected = false;
+      connecting = false;
+      air.clear();
+      command.clear();
+      uart.clear();
+    }
+
+    void setInRange(bool range) {
+      inRange = range;
+      if (other) other->inRange = range;
+      if (!range) disconnect();
+    }
+
+    void poll() {
+      uint64_t now = HostSim::clockMicros;
+
+      while (uart.available() > 0) {
+        uint8_t b = uart.read();
+        if (connected) {
+          uint64_t jitter = airJitterMicros ? (uint64_t)rand() % airJitterMicros : 0;
+          air.push_back(std::make_pair(now + airLatencyMicros + jitter, b));
+        } else {
+          command += (char)b;
+          lastCommandByte = now;
+        }
+      }
+
+      // forward what has crossed the air
+      while (!air.empty() && air.front().first <= now) {
+        if (other && other->connected) other->uart.write(air.front().second);
+        air.pop_front();
+      }
+
+      if (!command.empty() && now - lastCommandByte >= commandGapMicros) {
+        answer(command);
+        command.clear();
+      }
+
+      if (connecting && now >= connectAt) {
+        connecting = false;
+        if (other && inRange && !other->connected && other->role == 0 && other->address == target) {
+          connected = true;
+          other->connected = true;
+          lastPeer = other->address;
+          other->lastPeer = address;
+          reply("OK+CONN");
+          other->reply("OK+CONN");
+        } else if (now >= connectGiveUp) {
+          reply("OK+CONNF");
+        } else {
+          // keep trying until the timeout, as the module does
+          connecting = true;
+          connectAt = now + connectMicros;
+        }
+      }
+
+      if (statePin >= 0 && statePin < NUM_HOST_PINS) {
+        HostSim::pinLevel[statePin] = connected || (now / 500000) % 2 ? HIGH : LOW;
+      }
+    }
+
+  private:
+    std::string command;
+    uint64_t lastCommandByte = 0;
+    std::deque<std::pair<uint64_t, uint8_t>> air;
+    bool connecting = false;
+    uint64_t connectAt = 0;
+    uint64_t connectGiveUp = 0;
+    std::string target;
+
+    void reply(const std::string &s) {
+      for (char c : s) uart.write((uint8_t)c);
+    }
+
+    void answer(const std::string &cmd) {
+      if (cmd.compare(0, 2, "AT") != 0) return;   // not a command, ignored
+      commands++;
+      std::string arg = cmd.substr(2);
+
+      if (arg.empty()) {
+        reply("OK");
+      } else if (arg.compare(0, 4, "+CON") == 0 && arg.size() == 16) {
+        if (role != 1) {
+          reply("OK+CONNE");
+          return;
+        }
+        target = arg.substr(4);
+        connecting = true;
+        connectAt = HostSim::clockMicros + connectMicros;
+        connectGiveUp = HostSim::clockMicros + connectTimeoutMicros;
+        reply("OK+CONNA");
+      } else if (arg == "+ROLE?") {
+        reply("OK+Get:" + std::to_string(role));
+      } else if (arg.compare(0, 5, "+ROLE") == 0 && arg.size() == 6) {
+        role = arg[5] - '0';
+        writes++;
+        reply("OK+Set:" + std::to_string(role));
+      } else if (arg == "+NAME?") {
+        reply("OK+NAME:" + name);
+      } else if (arg.compare(0, 5, "+NAME") == 0 && arg.size() > 5) {
+        name = arg.substr(5, 12);
+        writes++;
+        reply("OK+Set:" + name);
+      } else if (arg == "+ADDR?") {
+        reply("OK+ADDR:" + address);
+      } else if (arg == "+RADD?") {
+        reply("OK+RADD:" + lastPeer);
+      } else {
+        reply("ERROR");
+      }
+    }
+};
+
+#endif
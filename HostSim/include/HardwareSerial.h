@@ -0,0 +1,120 @@
+/*
+  Host serial port. Received bytes are queued by the test program with inject(), and written
+  bytes are kept in 'output' or forwarded to a connected peer port to emulate a paired link.
+
+  With 'baud' set, bytes forwarded to the peer arrive one character time (10 bits) apart on the
+  simulated clock, as they would over the UART and Bluetooth link; 0 delivers them at once.
+  Bytes wait in a transmit buffer of txBufferSize like the AVR core's; write() blocks, moving
+  the clock on, while it is full.
+*/
+
+#ifndef HostSim_HardwareSerial_h
+#define HostSim_HardwareSerial_h
+
+#include <algorithm>
+#include <deque>
+#include <string>
+
+class HardwareSerial : public Stream {
+  public:
+    std::deque<uint8_t> input;
+    std::deque<uint64_t> arrivalMicros;   // when each byte in 'input' can be read
+    std::string output;
+    HardwareSerial *peer = nullptr;
+    unsigned long baud = 0;
+    size_t txBufferSize = 64;   // SERIAL_TX_BUFFER_SIZE
+    bool echo = false;
+
+    void begin(unsigned long baud) { (void)baud; }
+    void end() { }
+    operator bool() const { return true; }
+
+    int available() override {
+      // arrival times only increase, so the bytes that have arrived are at the front
+      auto arrived = std::upper_bound(arrivalMicros.begin(), arrivalMicros.end(), HostSim::clockMicros);
+      return arrived - arrivalMicros.begin();
+    }
+    int read() override {
+      if (input.empty() || arrivalMicros.front() > HostSim::clockMicros) return -1;
+      uint8_t b = input.front();
+      input.pop_front();
+      arrivalMicros.pop_front();
+      return b;
+    }
+    int peek() override {
+      if (input.empty() || arrivalMicros.front() > HostSim::clockMicros) return -1;
+      return input.front();
+    }
+
+    int availableForWrite() override {
+      if (!peer || !baud) return txBufferSize - 1;
+      drainTxBuffer();
+      return txBufferSize - 1 - txStartMicros.size();
+    }
+
+    size_t write(uint8_t b) override {
+      if (peer) {
+        uint64_t arrival = HostSim::clockMicros;
+        if (baud) {
+          drainTxBuffer();
+          if (txStartMicros.size() >= txBufferSize - 1) {
+            // wait, as the AVR core does, for the oldest byte to start on the line
+            HostSim::clockMicros = txStartMicros.front();
+            drainTxBuffer();
+          }
+          uint64_t start = std::max(lineFreeMicros, HostSim::clockMicros);
+          lineFreeMicros = start + 10000000 / baud;
+          txStartMicros.push_back(start);
+          arrival = lineFreeMicros;
+        }
+        peer->arrive(b, arrival);
+      } else {
+        output += (char)b;
+      }
+      if (echo) {
+        putchar(b);
+      }
+      return 1;
+    }
+    using Print::write;
+
+    void inject(const uint8_t *data, size_t len) {
+      while (len--) {
+        arrive(*data++, 0);
+      }
+    }
+    void inject(const String &s) { inject((const uint8_t *)s.c_str(), s.length()); }
+
+    void clear() {
+      input.clear();
+      arrivalMicros.clear();
+      output.clear();
+      txStartMicros.clear();
+      lineFreeMicros = 0;
+    }
+
+  private:
+    uint64_t lineFreeMicros = 0;          // when the last byte written finishes arriving
+    std::deque<uint64_t> txStartMicros;   // when each byte in the transmit buffer starts on the line
+
+    void drainTxBuffer() {
+      while (!txStartMicros.empty() && txStartMicros.front() <= HostSim::clockMicros) {
+        txStartMicros.pop_front();
+      }
+    }
+
+    void arrive(uint8_t b, uint64_t when) {
+      if (!arrivalMicros.empty() && when < arrivalMicros.back()) {
+        when = arrivalMicros.back();
+      }
+      input.push_back(b);
+      arrivalMicros.push_back(when);
+    }
+};
+
+inline HardwareSerial Serial;
+inline HardwareSerial Serial1;
+inline HardwareSerial Serial2;
+inline HardwareSerial Serial3;
+
+#endif
@@ -0,0 +1,57 @@
+/*
+  Builds the UnoTestFrameWork sketch on the host.
+  The Arduino IDE generates these prototypes and joins the .ino files (main sketch first, then the
+  rest alphabetically); a plain C++ build has to do both itself.
+*/
+
+#ifndef HostSim_UnoTestFrameWorkSketch_h
+#define HostSim_UnoTestFrameWorkSketch_h
+
+#include <Arduino.h>
+#include <AltSoftSerial.h>
+#include <BluetoothLink.h>
+
+// OtherFunctions.ino
+void printBTStatus();
+String randomString(int len);
+String randomStringOfAnyASCII(int len);
+int randomValue(int minValue, int maxValue);
+
+// ReceiveTest.ino
+void writeRecievedToFile();
+
+// SendTest.ino
+void testAllOrders();
+void sendCorruptData();
+
+// UnoBlueTooth.ino
+void beginBluetooth(int baudRate);
+String * getBTData();
+int getBTDataSize();
+void clearMemory();
+boolean getConnectionStatus();
+boolean isLinkUp();
+size_t drainCapture();
+boolean connectBluetooth();
+void doATCommandSetup();
+boolean sendIntArray(int intData[]);
+boolean sendData(String data[], int arraySize);
+boolean sendUrgentData(String data[], int arraySize);
+boolean sendAndWait(String data[], int arraySize, byte priority);
+boolean receivedNewData();
+void receivedCansError(const BluetoothMessage &message);
+void receivedUnknownMessage(const BluetoothMessage &message);
+String buildPacket(String data[], int arraySize);
+void transmitData(String data);
+void readFromSerialToBT();
+void readFromBlueTooth();
+
+#include "../../UnoTestFrameWork/UnoTestFrameWork.ino"
+#include "../../UnoTestFrameWork/OtherFunctions.ino"
+#include "../../UnoTestFrameWork/ReceiveTest.ino"
+#include "../../UnoTestFrameWork/SendTest.ino"
+#include "../../UnoTestFrameWork/UnoBlueTooth.ino"
+
+#include <BluetoothLinkSources.h>
+
+#endif
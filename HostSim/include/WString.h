@@ -0,0 +1,185 @@
+/*
+  Host version of the Arduino String class.
+  Searches use the C string functions like the AVR core does, so a NUL byte inside a String
+  hides everything after it from indexOf(), the same as on the boards.
+*/
+
+#ifndef HostSim_WString_h
+#define HostSim_WString_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <string>
+
+// the host has no separate program memory, so F() strings stay ordinary C strings
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+
+class String {
+  public:
+    String() { }
+    String(const char *cstr) { if (cstr) buffer = cstr; }
+    String(const __FlashStringHelper *str) : String(reinterpret_cast<const char *>(str)) { }
+    String(const String &other) = default;
+    String(String &&other) = default;
+    String(char c) : buffer(1, c) { }
+    String(unsigned char value, unsigned char base = 10) { fromNumber(value, base); }
+    String(int value, unsigned char base = 10) { fromNumber(value, base); }
+    String(unsigned int value, unsigned char base = 10) { fromNumber(value, base); }
+    String(long value, unsigned char base = 10) { fromNumber(value, base); }
+    String(unsigned long value, unsigned char base = 10) { fromNumber(value, base); }
+
+    String &operator=(const String &rhs) = default;
+    String &operator=(String &&rhs) = default;
+    String &operator=(const char *cstr) { buffer = cstr ? cstr : ""; return *this; }
+
+    unsigned int length() const { return buffer.size(); }
+    const char *c_str() const { return buffer.c_str(); }
+    unsigned char reserve(unsigned int size) { buffer.reserve(size); return 1; }
+
+    unsigned char concat(const String &s) { buffer += s.buffer; return 1; }
+    unsigned char concat(const char *cstr) { if (!cstr) return 0; buffer += cstr; return 1; }
+    unsigned char concat(const char *cstr, unsigned int len) { buffer.append(cstr, len); return 1; }
+    unsigned char concat(char c) { buffer += c; return 1; }
+    unsigned char concat(unsigned char num) { return concat(String(num)); }
+    unsigned char concat(int num) { return concat(String(num)); }
+    unsigned char concat(unsigned int num) { return concat(String(num)); }
+    unsigned char concat(long num) { return concat(String(num)); }
+    unsigned char concat(unsigned long num) { return concat(String(num)); }
+
+    String &operator+=(const String &rhs) { concat(rhs); return *this; }
+    String &operator+=(const char *cstr) { concat(cstr); return *this; }
+    String &operator+=(char c) { concat(c); return *this; }
+
+    unsigned char equals(const String &s) const { return buffer == s.buffer; }
+    unsigned char equals(const char *cstr) const { return buffer == (cstr ? cstr : ""); }
+    unsigned char operator==(const String &rhs) const { return equals(rhs); }
+    unsigned char operator==(const char *cstr) const { return equals(cstr); }
+    unsigned char operator!=(const String &rhs) const { return !equals(rhs); }
+    unsigned char operator!=(const char *cstr) const { return !equals(cstr); }
+    unsigned char startsWith(const String &prefix) const {
+      return buffer.compare(0, prefix.buffer.size(), prefix.buffer) == 0;
+    }
+    unsigned char endsWith(const String &suffix) const {
+      return buffer.size() >= suffix.buffer.size() &&
+             buffer.compare(buffer.size() - suffix.buffer.size(), suffix.buffer.size(), suffix.buffer) == 0;
+    }
+
+    char charAt(unsigned int index) const { return index < buffer.size() ? buffer[index] : 0; }
+    void setCharAt(unsigned int index, char c) { if (index < buffer.size()) buffer[index] = c; }
+    char operator[](unsigned int index) const { return charAt(index); }
+    char &operator[](unsigned int index) { return buffer[index]; }
+    void getBytes(unsigned char *buf, unsigned int bufsize, unsigned int index = 0) const {
+      if (!bufsize || !buf) return;
+      if (index >= buffer.size()) {
+        buf[0] = 0;
+        return;
+      }
+      unsigned int n = bufsize - 1;
+      if (n > buffer.size() - index) n = buffer.size() - index;
+      memcpy(buf, buffer.data() + index, n);
+      buf[n] = 0;
+    }
+    void toCharArray(char *buf, unsigned int bufsize, unsigned int index = 0) const {
+      getBytes((unsigned char *)buf, bufsize, index);
+    }
+
+    int indexOf(char ch, unsigned int fromIndex = 0) const {
+      if (fromIndex >= buffer.size()) return -1;
+      const char *temp = strchr(buffer.c_str() + fromIndex, ch);
+      return temp ? temp - buffer.c_str() : -1;
+    }
+    int indexOf(const String &s, unsigned int fromIndex = 0) const {
+      if (fromIndex >= buffer.size()) return -1;
+      const char *found = strstr(buffer.c_str() + fromIndex, s.buffer.c_str());
+      return found ? found - buffer.c_str() : -1;
+    }
+    int lastIndexOf(char ch) const {
+      const char *temp = strrchr(buffer.c_str(), ch);
+      return temp ? temp - buffer.c_str() : -1;
+    }
+
+    String substring(unsigned int beginIndex) const { return substring(beginIndex, buffer.size()); }
+    String substring(unsigned int left, unsigned int right) const {
+      if (left > right) {
+        unsigned int temp = right;
+        right = left;
+        left = temp;
+      }
+      String out;
+      if (left >= buffer.size()) return out;
+      if (right > buffer.size()) right = buffer.size();
+      out.buffer.assign(buffer, left, right - left);
+      return out;
+    }
+
+    void remove(unsigned int index) { remove(index, (unsigned int)-1); }
+    void remove(unsigned int index, unsigned int count) {
+      if (index >= buffer.size()) return;
+      if (count > buffer.size() - index) count = buffer.size() - index;
+      buffer.erase(index, count);
+    }
+    void trim() {
+      size_t b = buffer.find_first_not_of(" \t\r\n");
+      size_t e = buffer.find_last_not_of(" \t\r\n");
+      buffer = b == std::string::npos ? "" : buffer.substr(b, e - b + 1);
+    }
+
+    long toInt() const { return atol(buffer.c_str()); }
+
+  private:
+    std::string buffer;
+
+    void fromNumber(long value, unsigned char base) {
+      char buf[34];
+      if (base == 16) snprintf(buf, sizeof(buf), "%lx", value);
+      else snprintf(buf, sizeof(buf), "%ld", value);
+      buffer = buf;
+    }
+    void fromNumber(unsigned long value, unsigned char base) {
+      char buf[34];
+      if (base == 16) snprintf(buf, sizeof(buf), "%lx", value);
+      else snprintf(buf, sizeof(buf), "%lu", value);
+      buffer = buf;
+    }
+    void fromNumber(int value, unsigned char base) { fromNumber((long)value, base); }
+    void fromNumber(unsigned int value, unsigned char base) { fromNumber((unsigned long)value, base); }
+    void fromNumber(unsigned char value, unsigned char base) { fromNumber((unsigned long)value, base); }
+};
+
+inline String operator+(const String &lhs, const String &rhs) {
+  String s(lhs);
+  s.concat(rhs);
+  return s;
+}
+inline String operator+(const String &lhs, const char *rhs) {
+  String s(lhs);
+  s.concat(rhs);
+  return s;
+}
+inline String operator+(const char *lhs, const String &rhs) {
+  String s(lhs);
+  s.concat(rhs);
+  return s;
+}
+inline String operator+(const String &lhs, char rhs) {
+  String s(lhs);
+  s.concat(rhs);
+  return s;
+}
+inline String operator+(char lhs, const String &rhs) {
+  String s(lhs);
+  s.concat(rhs);
+  return s;
+}
+
+// Numbers are appended as decimal text, matching StringSumHelper on the boards
+inline String operator+(const String &lhs, unsigned char rhs) { return lhs + String(rhs); }
+inline String operator+(const String &lhs, int rhs) { return lhs + String(rhs); }
+inline String operator+(const String &lhs, unsigned int rhs) { return lhs + String(rhs); }
+inline String operator+(const String &lhs, long rhs) { return lhs + String(rhs); }
+inline String operator+(const String &lhs, unsigned long rhs) { return lhs + String(rhs); }
+
+#endif
@@ -0,0 +1,14 @@
+/*
+  Interrupt helpers for host builds. Interrupt service routines become plain functions
+  which the simulator calls when it decides the vector would have been serviced.
+*/
+
+#ifndef HostSim_avr_interrupt_h
+#define HostSim_avr_interrupt_h
+
+#define ISR(vector) void vector(void)
+
+#define cli()
+#define sei()
+
+#endif
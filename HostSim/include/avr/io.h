@@ -0,0 +1,62 @@
+/*
+  Simulated ATmega328P register file for host builds.
+  Only Timer1, which AltSoftSerial uses on the Uno, is modelled. The register storage and the
+  timer count are provided by whichever host program links against them (see AltSoftSerialSim).
+*/
+
+#ifndef HostSim_avr_io_h
+#define HostSim_avr_io_h
+
+#include <stdint.h>
+
+#ifndef __AVR_ATmega328P__
+#define __AVR_ATmega328P__
+#endif
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+// Interrupt flag registers are cleared by writing a 1 to the flag bit
+struct SimFlagRegister {
+  volatile uint8_t flags;
+  SimFlagRegister &operator=(uint8_t v) { flags &= (uint8_t)~v; return *this; }
+  operator uint8_t() const { return flags; }
+};
+
+extern volatile uint8_t SREG;
+
+extern volatile uint8_t TCCR1A;
+extern volatile uint8_t TCCR1B;
+extern volatile uint8_t TIMSK1;
+extern SimFlagRegister TIFR1;
+extern volatile uint16_t ICR1;
+extern volatile uint16_t OCR1A;
+extern volatile uint16_t OCR1B;
+
+// TCNT1 is read-only in AltSoftSerial and follows the simulated clock
+uint16_t simTimer1Count();
+#define TCNT1 (simTimer1Count())
+
+// TCCR1A
+#define COM1A1  7
+#define COM1A0  6
+#define COM1B1  5
+#define COM1B0  4
+
+// TCCR1B
+#define ICNC1   7
+#define ICES1   6
+#define CS12    2
+#define CS11    1
+#define CS10    0
+
+// TIMSK1 / TIFR1
+#define ICIE1   5
+#define OCIE1B  2
+#define OCIE1A  1
+#define ICF1    5
+#define OCF1B   2
+#define OCF1A   1
+
+#endif
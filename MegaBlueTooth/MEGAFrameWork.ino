@@ -1,3 +1,7 @@
+// Further links, e.g. to a second robot or a logging radio, run alongside the one to the Uno:
+//   BluetoothLink loggingRadio(Serial2, 12);   with the other BluetoothLink above setup()
+//   Serial2.begin(9600);                       in setup()
+//   loggingRadio.update();                     in loop(), then loggingRadio.receivedNewData()
 
 void setup() {
   beginBluetooth(9600);
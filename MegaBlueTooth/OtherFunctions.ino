@@ -47,6 +47,8 @@ void sendTestData() {
 void receiveTestData() {
   Serial.println("\n================= Receive Test Begin\n");
   
+  // stored for getBTData() instead of passed to its handler while testing
+  bluetooth.setHandlers(NULL, 0, NULL);
   if (receivedNewData()) {
     Serial.println("\nMessage retrieved from memory:");
     String *message = getBTData();
@@ -67,6 +69,7 @@ void receiveTestData() {
       Serial.println(*(message + i));
     }
   }
+  bluetooth.setHandlers(messageHandlers, numMessageTypes, receivedUnknownMessage);
   Serial.println("\n================= Receive Test End\n");
 }
 
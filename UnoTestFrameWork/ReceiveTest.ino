@@ -3,6 +3,8 @@ int receiveCount = 0;
 /*
   Write to serial monitor over COM port. Using processing program, read the data from serial
   and write to file.
+  For the bytes themselves and their timing, set captureLength and call drainCapture() instead,
+  see HostSim/Replay.
 */
 void writeRecievedToFile() {
   // called after receivedNewData() 
@@ -1,3 +1,5 @@
+#include <BluetoothMessageTypes.h>
+
 int maxCan = 10;
 int maxOneColour = 8;
 
@@ -43,7 +45,7 @@ void sendCorruptData() {
   int testSampleSize = 100;
 
   int arraySize = 4;
-  String sampleData[arraySize] = {"INT", "",  "", ""};
+  String sampleData[arraySize] = {String(MESSAGE_CANS_ERROR), "",  "", ""};
 
   int sentCounter = 0;
 
@@ -69,17 +71,7 @@ void sendCorruptData() {
 
     // Build packet for transmission
     // Assumes system always correctly builds data
-
-    addMarker(&sampleData[0], arraySize);
-
-    // Convert to single String
-    String packet = transformToString(sampleData, arraySize);
-
-    // Prepend checksum
-    packet = addCheckSum(packet);
-
-    // add packet markers
-    packet = "<" + packet + ">";
+    String packet = buildPacket(sampleData, arraySize);
 
 
     // add corruption simulation
@@ -152,6 +152,17 @@ void AltSoftSerial::writeByte(uint8_t b)
 }
 
 
+int AltSoftSerial::availableForWrite(void)
+{
+	uint8_t head, tail;
+
+	head = tx_buffer_head;
+	tail = tx_buffer_tail;
+	if (tail > head) return tail - head - 1;
+	return TX_BUFFER_SIZE + tail - head - 1;
+}
+
+
 ISR(COMPARE_A_INTERRUPT)
 {
 	uint8_t state, byte, bit, head, tail;
@@ -234,6 +245,11 @@ ISR(CAPTURE_INTERRUPT)
 		CONFIG_CAPTURE_RISING_EDGE();
 		rx_bit = 0x80;
 	}
+	// serviced more than one bit after the edge: the opposite edge may
+	// already have passed while the capture polarity was still unchanged
+	if ((uint16_t)(GET_TIMER_COUNT() - capture) > ticks_per_bit) {
+		AltSoftSerial::timing_error = true;
+	}
 	state = rx_state;
 	if (state == 0) {
 		if (!bit) {
@@ -269,7 +285,6 @@ ISR(CAPTURE_INTERRUPT)
 		rx_target = target;
 		rx_state = state;
 	}
-	//if (GET_TIMER_COUNT() - capture > ticks_per_bit) AltSoftSerial::timing_error = true;
 }
 
 ISR(COMPARE_B_INTERRUPT)
@@ -278,6 +293,11 @@ ISR(COMPARE_B_INTERRUPT)
 
 	DISABLE_INT_COMPARE_B();
 	CONFIG_CAPTURE_FALLING_EDGE();
+	// serviced after the stop bit ended (rx_stop_ticks is 9.25 bits): the
+	// next start bit may already have been taken as a bit of this byte
+	if ((uint16_t)(GET_TIMER_COUNT() - GET_COMPARE_B()) > ticks_per_bit * 3 / 4) {
+		AltSoftSerial::timing_error = true;
+	}
 	state = rx_state;
 	bit = rx_bit ^ 0x80;
 	while (state < 9) {
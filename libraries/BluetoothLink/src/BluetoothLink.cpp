@@ -0,0 +1,1341 @@
+/*
+  BluetoothLink
+  Functions outlined in the header file is implement here.
+*/
+
+#include "BluetoothLink.h"
+
+
+/************************************************************************************************************************/
+/************************/
+/*    Initialize        */
+/************************/
+/************************************************************************************************************************/
+
+/*
+  @desc Creates a link on the given Serial port. The port must be started with begin() by the sketch.
+  @param Stream &port - Serial the Bluetooth module is connected to
+  @param uint8_t statusPin - pin connected to the STATE pin of the Bluetooth module
+*/
+BluetoothLink::BluetoothLink(Stream &port, uint8_t statusPin) {
+  this->port = &port;
+  this->statusPin = statusPin;
+  peerMAC = "";
+  transmitAttempts = 1;
+  urgentTransmitAttempts = 3;
+
+  rxLength = 0;
+  rxInPacket = false;
+  rxLastByteTime = 0;
+
+  storedTransmission = NULL;
+  storedSize = 0;
+  newData = false;
+  handlers = NULL;
+  handlerCount = 0;
+  fallbackHandler = NULL;
+  for (int i = 0; i < numPriorities; i++) {
+    ackDue[i] = false;
+    ackStale[i] = false;
+    txDelivered[i] = false;
+    txStale[i] = false;
+    ackSequence[i] = noSequence;
+    rxLastSequence[i] = noSequence;
+  }
+
+  for (int i = 0; i < sendQueueLength; i++) {
+    txQueue[i].state = SLOT_EMPTY;
+  }
+  txCurrent = -1;
+  txOffset = 0;
+  txSequence = 0;
+  txOrder = 0;
+  portReportsRoom = false;
+  portRoomMax = 0;
+
+  transferAttempts = 5;
+  transferWindow = NULL;
+  transferFrame = NULL;
+  transferFrameSize = 0;
+  transferFrameOffset = 0;
+  transferId = 0;
+  transferLength = 0;
+  transferWritten = 0;
+  transferSent = 0;
+  transferAcked = 0;
+  transferTimer = 0;
+  transferTimeouts = 0;
+  transferIsStalled = false;
+  transferOk = false;
+
+  rxTransferId = -1;
+  rxTransferLength = 0;
+  rxTransferTaken = 0;
+  rxChunk = NULL;
+  rxChunkSize = 0;
+  rxChunkReady = false;
+  transferAckDue = false;
+
+  memset(&stats, 0, sizeof(stats));
+
+  // assumed up until nothing is heard for linkTimeout
+  autoReconnect = true;
+  linkState = LINK_UP;
+  lastHeardTime = 0;
+  lastSentTime = 0;
+  lastWriteTime = 0;
+  linkLostTime = 0;
+  reconnectTime = 0;
+  moduleDisconnected = false;
+  heartbeatWaiting = false;
+  heartbeatSequence = 0;
+  heartbeatSentTime = 0;
+  heartbeatSentMicros = 0;
+  heartbeatHistory = 0;
+  heartbeatCount = 0;
+  pongDue = false;
+  pongDueTime = 0;
+  pongSequence = noSequence;
+  atBuffer[0] = '\0';
+  atLength = 0;
+  atLastByteTime = 0;
+  atConnPending = false;
+  memset(&quality, 0, sizeof(quality));
+
+  timestampPackets = false;
+  maxDataAge = 0;
+  clockSamples = 0;
+  clockNext = 0;
+  clockDrift = 0;
+  clockDriftKnown = false;
+  driftAnchorOffset = 0;
+  driftAnchorTime = 0;
+  memset(&pairing, 0, sizeof(pairing));
+  pairingAddress = noPairingCache;
+  pairingValid = false;
+
+  captureRing = NULL;
+  captureSize = 0;
+  captureHead = 0;
+  captureTail = 0;
+  captureUsed = 0;
+  captureTailMicros = 0;
+  captureLastMicros = 0;
+  captureDropped = 0;
+  captureStage = NULL;
+  captureStaged = 0;
+
+  rxStartMicros = 0;
+  pingReceivedMicros = 0;
+  rxLatency = noLatency;
+
+  debugPort = NULL;
+  includeErrorMessage = false;
+  testingMessages = false;
+}
+
+BluetoothLink::~BluetoothLink() {
+  delete[] storedTransmission;
+  delete[] transferWindow;
+  delete[] transferFrame;
+  delete[] captureRing;
+  delete[] captureStage;
+}
+
+/*
+  @desc Services the link: reads incoming packets, acknowledges them, and moves the queued
+  packets along. Must be called from loop() for every link.
+  Reads at most maxBytesPerUpdate bytes and at most one packet, writes at most one BLE chunk
+  and the acknowledgements that are due.
+  A transfer chunk not taken with receivedTransferData() since the last call is not acknowledged,
+  and is sent again by the other device.
+  Sends a heartbeat when nothing has been sent for heartbeatInterval, and reconnects in the
+  background when the link is lost, see BluetoothLink.h.
+  @param
+  @return
+*/
+void BluetoothLink::update() {
+  unsigned long now = millis();
+  unsigned long bytesSent = stats.bytesSent;
+
+  // the chunk is in rxBuffer, which is about to be reused
+  rxChunkReady = false;
+
+  readFromBTBuffer(now);
+  checkLink(now);
+  checkAckTimeouts(now);
+  checkTransferTimeout(now);
+
+  // the module takes anything written while it connects as an AT command. It is only connecting
+  // once it has dropped the connection, so there is no one to answer until OK+CONN.
+  if (linkState == LINK_CONNECTING) {
+    return;
+  }
+
+  // urgent first, it may cut short the normal packet being sent
+  for (int priority = PRIORITY_URGENT; priority >= PRIORITY_NORMAL; priority--) {
+    if (ackDue[priority] && canWrite(maxAckLength) && canInterrupt(priority)) {
+      interruptCurrent();
+      sendAcknowledge(priority, ackSequence[priority]);
+    }
+  }
+  if (transferAckDue && canWrite(maxTransferAckLength) && canInterrupt(PRIORITY_NORMAL)) {
+    interruptCurrent();
+    sendTransferAcknowledge();
+  }
+  // the answer's timestamp is only right if nothing is ahead of it in the transmit buffer
+  if (pongDue && (transmitBufferEmpty() || now - pongDueTime >= maxReplyDelay) &&
+      canWrite(maxHeartbeatLength) && canInterrupt(PRIORITY_NORMAL)) {
+    interruptCurrent();
+    sendHeartbeatReply();
+  }
+
+  // heartbeats carry on while the link is lost, in case only the other device thinks it is up,
+  // and every clockSyncInterval while busy to keep the clock offset up
+  if (!heartbeatWaiting && txCurrent < 0 && now - heartbeatSentTime >= heartbeatInterval &&
+      (now - lastSentTime >= heartbeatInterval || now - heartbeatSentTime >= clockSyncInterval) &&
+      canWrite(maxHeartbeatLength)) {
+    sendHeartbeat(now);
+  }
+
+  if (linkState == LINK_UP) {
+    transmitChunk(now);
+  }
+
+  if (stats.bytesSent != bytesSent) {
+    lastWriteTime = now;
+  }
+}
+
+/*
+  @desc Prints error messages and/or the stages of each transmission to the given port
+  @param Print &debugPort - usually Serial
+  @param boolean errorMessages
+  @param boolean testingMessages
+  @return
+*/
+void BluetoothLink::setDebug(Print &debugPort, boolean errorMessages, boolean testingMessages) {
+  this->debugPort = &debugPort;
+  includeErrorMessage = errorMessages;
+  this->testingMessages = testingMessages;
+}
+
+
+/************************************************************************************************************************/
+/************************/
+/*  Settings & Status   */
+/************************/
+/************************************************************************************************************************/
+
+/*
+  @desc Returns the counters kept by this link
+  @param
+  @return BluetoothLinkStats
+*/
+const BluetoothLinkStats &BluetoothLink::getStats() {
+  return stats;
+}
+
+/*
+  @desc Sets the MAC address of the device connect() pairs with
+  @param String mac
+  @return
+*/
+void BluetoothLink::setPeerMAC(const String &mac) {
+  peerMAC = mac;
+}
+
+/*
+  @desc Returns the MAC address of the device connect() pairs with
+  @param
+  @return String mac
+*/
+const String &BluetoothLink::getPeerMAC() {
+  return peerMAC;
+}
+
+/*
+  @desc Returns the paired status of the BlueTooth module.
+  @param
+  @return boolean - true if paired, false if not paired
+*/
+boolean BluetoothLink::getConnectionStatus() {
+  /*
+     Polls the state pin several times and checks whether it is BLINKING or HIGH.
+     HM-10 BLE module BLINKs every 500ms when not paired.
+     Polling needs to have sufficient fidelity to account for this timing.
+  */
+  int pollCount = 7;  // number of times to poll state pin
+  int pollDelay = 100; // period (ms) between polls
+
+  while (pollCount > 0) {
+    if (!digitalRead(statusPin)) {
+      return false;
+    }
+    pollCount--;
+    delay(pollDelay);
+  }
+  return true;
+}
+
+/*
+  @desc Pairs the BTLE with the device correseponding to the stored MAC address.
+  @param
+  @return boolean - true if pairing successfull
+  @return boolean - false if pairing unsuccessfull
+*/
+boolean BluetoothLink::connect() {
+  if (!canDoAT()) {
+    return false;
+  }
+  String successFlags[] = {"OK", "Set"};
+
+  transmit("AT+CON" + peerMAC);
+
+  int numFlags = sizeof(successFlags) / sizeof(successFlags[0]);
+  if (isATSucessfull(atResponse(), successFlags, numFlags)) {
+    if (includeErrorMessage) {
+      debugPort->println(F("Bluetooth has been connected"));
+    }
+    linkRestored(millis());
+    return true;
+  } else {
+    if (includeErrorMessage) {
+      debugPort->println(F("Bluetooth failed to connect"));
+    }
+    return false;
+  }
+}
+
+/*
+  @desc Changes the name of the Bluetooth module to the string given.
+  Max name length is 12 characters
+  @param String name
+  @return boolean - true if the module confirmed the change
+*/
+boolean BluetoothLink::changeName(String newName) {
+  String successFlags[] = {"OK", "Set", newName};
+
+  transmit("AT+NAME" + newName);
+
+  int numFlags = sizeof(successFlags) / sizeof(successFlags[0]);
+  boolean changed = isATSucessfull(atResponse(), successFlags, numFlags);
+  if (includeErrorMessage) {
+    if (changed) {
+      debugPort->print(F("BLE name changed to "));
+      debugPort->println(newName);
+    } else {
+      debugPort->println(F("Failed to change name"));
+    }
+  }
+  return changed;
+}
+
+/*
+  @desc Changes the role of the Bluetooth module
+  @param int role. 0=slave, 1=master
+  @return boolean - true if the module confirmed the change
+*/
+boolean BluetoothLink::changeRole(int role) {
+  String successFlags[] = {"OK", "Set", String(role)};
+
+  transmit("AT+ROLE" + String(role));
+
+  int numFlags = sizeof(successFlags) / sizeof(successFlags[0]);
+  boolean changed = isATSucessfull(atResponse(), successFlags, numFlags);
+  if (includeErrorMessage) {
+    if (changed) {
+      debugPort->print(F("BLE role changed to "));
+      debugPort->println(role);
+    } else {
+      debugPort->println(F("Failed to change role"));
+    }
+  }
+  return changed;
+}
+
+/*
+  @desc Check that the given response string contains all the given success flags
+  @param String response - reponse given back by AT commands
+  @param String successFlags[] - array of success flags
+  @return boolean - true if all flags are found in the response
+  @return boolean - false if not all flags are found in the response
+*/
+boolean BluetoothLink::isATSucessfull(String response, String successFlags[], int numFlags) {
+  for (int index = 0; index < numFlags; index++) {
+    if (response.indexOf(successFlags[index]) < 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+  @desc Listen on the Serial port for a response, reads it and returns it as a single string.
+  Blocks for up to atTimeout, only for use while the link is not paired.
+  @param
+  @return String - response
+*/
+String BluetoothLink::atResponse() {
+  if (!canDoAT()) {
+    return "ERROR";
+  }
+
+  String response = "";
+  unsigned long timeStart = millis();
+
+  // Check if there is a response within timeout period
+  while (!port->available()) {
+    if ((millis() - timeStart) > atTimeout) {
+      if (includeErrorMessage) {
+        debugPort->println(F("AT Response Timeout"));
+      }
+      return "TIMEOUT";
+    }
+  }
+
+  // Allow full response to load into buffer
+  delay(150);
+
+  // Read response
+  while (port->available()) {
+    char c = port->read();
+    response.concat(c);
+  }
+  captureBytes(CAPTURE_RX, (const uint8_t *)response.c_str(), response.length());
+  if (includeErrorMessage) {
+    debugPort->println();
+    debugPort->println(response);
+  }
+  return response;
+}
+
+/*
+  @desc Checks whether the conditions are met to execute AT commands
+  @param
+  @return boolean - false if not able to execute AT commands
+  @return boolean - true if able to execute AT commands
+*/
+boolean BluetoothLink::canDoAT() {
+  if (!getConnectionStatus()) {
+    return true;
+  } else {
+    if (includeErrorMessage) {
+      debugPort->println(F("Error.\nBlueTooth is currently paired, unable to perform AT commands"));
+    }
+    return false;
+  }
+}
+
+
+/************************************************************************************************************************/
+/************************/
+/*      Transmit        */
+/************************/
+/************************************************************************************************************************/
+
+/*
+  @desc Queues an array of Strings for transmission. The packet is sent by update(), a chunk at a time,
+  after any packets of the same priority queued before it. Urgent packets go ahead of normal ones.
+  @param String data[] - array of message to be sent
+  @param int arraySize
+  @param byte priority - PRIORITY_NORMAL or PRIORITY_URGENT
+  @return boolean - true if the packet was queued
+  @return boolean - false if the queue is full, or the packet is too long
+*/
+boolean BluetoothLink::send(String data[], int arraySize, byte priority) {
+  if (priority > PRIORITY_URGENT) {
+    priority = PRIORITY_URGENT;
+  }
+
+  // the last free slot is kept for urgent packets
+  int slot = -1;
+  int freeSlots = 0;
+  for (int i = 0; i < sendQueueLength; i++) {
+    if (txQueue[i].state == SLOT_EMPTY) {
+      slot = i;
+      freeSlots++;
+    }
+  }
+  if (freeSlots == 0 || (priority == PRIORITY_NORMAL && freeSlots == 1)) {
+    if (includeErrorMessage) {
+      debugPort->println(F("Send queue full"));
+    }
+    return false;
+  }
+
+  // the other device keeps the last sequence number it had across a reset of this one, and
+  // takes a packet with the same number as a repeat: start from an unlikely one. Not in the
+  // constructor, micros() does not run yet when a global link is made.
+  if (txOrder == 0) {
+    txSequence = (byte)(micros() >> 2);
+  }
+  String packet = buildPacket(data, arraySize, priority, txSequence, timestampPackets, (uint32_t)micros());
+  // stamped again if it is sent again, which keeps the length but for the checksum's digits
+  unsigned int longest = packet.length();
+  if (timestampPackets) {
+    longest += checksumDigits - (packet.indexOf(checksumEndMarker) - 2);
+  }
+  if (longest > maxPacketLength) {
+    if (includeErrorMessage) {
+      debugPort->println(F("Packet too long to send"));
+    }
+    return false;
+  }
+  if (testingMessages) {
+    debugPort->println(F("\nPacket queued:"));
+    debugPort->println(packet);
+  }
+
+  OutgoingPacket *out = txQueue + slot;
+  out->packet = packet;
+  out->state = SLOT_QUEUED;
+  out->priority = priority;
+  out->sequence = txSequence++;
+  out->attempts = 0;
+  out->sentBefore = false;
+  out->order = txOrder++;
+  out->queuedTime = millis();
+  return true;
+}
+
+/*
+  @desc Whether any packet given to send() is still queued or waiting for acknowledgement
+  @param
+  @return boolean
+*/
+boolean BluetoothLink::isSending() {
+  for (int i = 0; i < sendQueueLength; i++) {
+    if (txQueue[i].state != SLOT_EMPTY) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+  @desc Whether any packet of the given priority is still queued or waiting for acknowledgement
+  @param byte priority
+  @return boolean
+*/
+boolean BluetoothLink::isSending(byte priority) {
+  for (int i = 0; i < sendQueueLength; i++) {
+    if (txQueue[i].state != SLOT_EMPTY && txQueue[i].priority == priority) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+  @desc Takes the packets of the given priority off the queue, not delivered. One part way out is
+  cut short, and dropped by the other device.
+  @param byte priority
+  @return
+*/
+void BluetoothLink::cancelSend(byte priority) {
+  if (priority > PRIORITY_URGENT) {
+    priority = PRIORITY_URGENT;
+  }
+  unsigned long now = millis();
+  for (int i = 0; i < sendQueueLength; i++) {
+    if (txQueue[i].state != SLOT_EMPTY && txQueue[i].priority == priority) {
+      finishPacket(i, false, now);
+    }
+  }
+}
+
+/*
+  @desc Whether the last packet of the given priority to leave the queue was acknowledged by the other device
+  @param byte priority
+  @return boolean
+*/
+boolean BluetoothLink::lastSendDelivered(byte priority) {
+  if (priority > PRIORITY_URGENT) {
+    priority = PRIORITY_URGENT;
+  }
+  return txDelivered[priority];
+}
+
+/*
+  @desc Builds the packet for an array of Strings: line markers, data markers, sequence number,
+  checksum and packet markers
+  @param String data[] - array of message to be sent, left unchanged
+  @param int arraySize
+  @param byte priority - PRIORITY_NORMAL or PRIORITY_URGENT
+  @param int sequence - 0 to 255, or noSequence to leave out the sequence number
+  @param boolean stamped - whether to add the timestamp
+  @param uint32_t timestamp - sender's micros() when the data was produced
+  @return String - packet ready for transmission
+*/
+String BluetoothLink::buildPacket(String data[], int arraySize, byte priority, int sequence,
+                                  boolean stamped, uint32_t timestamp) {
+  String body = "";
+  if (sequence != noSequence) {
+    body.concat(priority == PRIORITY_URGENT ? urgentSequenceMarker : sequenceMarker);
+    body.concat(String(sequence));
+  }
+  if (stamped) {
+    body.concat(timestampMarker);
+    appendTimestamp(body, timestamp);
+  }
+  body.concat(dataStartMarker);
+  for (int i = 0; i < arraySize; i++) {
+    body.concat(lineStartMarker);
+    body.concat(*(data + i));
+    body.concat(lineEndMarker);
+  }
+  body.concat(dataEndMarker);
+  return framePacket(body);
+}
+
+/*
+  @desc Adds the checksum and packet markers to the body of a packet
+  @param String body - from the sequence number to the data end marker
+  @return String - packet
+*/
+String BluetoothLink::framePacket(const String &body) {
+  // encrypt - TODO, packets are currently sent as plain text
+
+  // Uses CRC8 CODE
+  uint8_t checksum = CRC8((const byte *)body.c_str(), body.length());
+
+  String packet = "";
+  packet.reserve(body.length() + 7);
+  packet.concat(packetStartMarker);
+  packet.concat(checksumStartMarker);
+  packet.concat(String(checksum));
+  packet.concat(checksumEndMarker);
+  packet.concat(body);
+  packet.concat(packetEndMarker);
+  return packet;
+}
+
+/*
+  @desc Returns the queued packet to send next: the highest priority, then the oldest.
+  Only one packet of each priority is sent at a time, the next waits for its acknowledgement.
+  @param
+  @return int - slot in the queue, -1 if nothing can be sent
+*/
+int BluetoothLink::nextQueued() {
+  boolean waiting[numPriorities] = {false, false};
+  for (int i = 0; i < sendQueueLength; i++) {
+    if (txQueue[i].state == SLOT_WAITING_ACK) {
+      waiting[txQueue[i].priority] = true;
+    }
+  }
+
+  int next = -1;
+  for (int i = 0; i < sendQueueLength; i++) {
+    OutgoingPacket *out = txQueue + i;
+    if (out->state != SLOT_QUEUED || i == txCurrent || waiting[out->priority]) {
+      continue;
+    }
+    if (next < 0 || out->priority > txQueue[next].priority ||
+        (out->priority == txQueue[next].priority && (long)(out->order - txQueue[next].order) < 0)) {
+      next = i;
+    }
+  }
+  return next;
+}
+
+/*
+  @desc Checks whether something of the given priority can be written now: nothing is part way
+  out, or what is can be cut short for it with interruptCurrent()
+  @param byte priority
+  @return boolean - true if it can be written after interruptCurrent()
+*/
+boolean BluetoothLink::canInterrupt(byte priority) {
+  return txCurrent < 0 || txOffset == 0 || priority > currentPriority();
+}
+
+/*
+  @desc Cuts short the packet that is part way out, called just before writing something urgent
+  that canInterrupt() allowed. The other device drops it when the next packet marker arrives,
+  and it is sent again from the start.
+  @param
+  @return
+*/
+void BluetoothLink::interruptCurrent() {
+  if (txCurrent < 0 || txOffset == 0) {
+    return;
+  }
+  if (testingMessages) {
+    debugPort->println(F("\nPacket cut short for an urgent one"));
+  }
+  if (txCurrent == transferSlot) {
+    transferFrameCut();
+  }
+  txCurrent = -1;
+  txOffset = 0;
+  stats.preemptions++;
+}
+
+/*
+  @desc Writes the next BLE sized chunk of the packet being sent, starting the next queued packet if
+  there is none. Waits while the Serial's transmit buffer cannot take the chunk, so an urgent packet
+  only has to wait behind what is already in the buffer.
+  @param unsigned long now - millis()
+  @return
+*/
+void BluetoothLink::transmitChunk(unsigned long now) {
+  int next = nextQueued();
+  if (next >= 0 && (txCurrent < 0 || txQueue[next].priority > currentPriority()) &&
+      canInterrupt(txQueue[next].priority)) {
+    interruptCurrent();
+    // a transfer frame built but not started yet is built again later
+    if (txCurrent == transferSlot) {
+      transferFrameCut();
+    }
+    txCurrent = next;
+    txOffset = 0;
+    if (txQueue[next].sentBefore) {
+      restampPacket(txQueue + next);
+    }
+  } else if (txCurrent < 0 && next < 0 && nextTransferFrame()) {
+    // the line is free, carry on with the transfer
+    txCurrent = transferSlot;
+    txOffset = 0;
+  }
+  if (txCurrent < 0) {
+    return;
+  }
+
+  const char *frame;
+  unsigned int frameLength;
+  if (txCurrent == transferSlot) {
+    frame = transferFrame;
+    frameLength = transferFrameSize;
+  } else {
+    frame = txQueue[txCurrent].packet.c_str();
+    frameLength = txQueue[txCurrent].packet.length();
+  }
+
+  unsigned int chunkLength = frameLength - txOffset;
+  if (chunkLength > bleChunkLength) {
+    chunkLength = bleChunkLength;
+  }
+
+  if (!canWrite(chunkLength)) {
+    return;
+  }
+
+  transmit((const uint8_t *)frame + txOffset, chunkLength);
+  txOffset += chunkLength;
+  stats.bytesSent += chunkLength;
+
+  if (txOffset < frameLength) {
+    return;
+  }
+  if (txCurrent == transferSlot) {
+    transferFrameSent(now);
+  } else {
+    OutgoingPacket *out = txQueue + txCurrent;
+    out->state = SLOT_WAITING_ACK;
+    out->sentTime = now;
+    out->attempts++;
+    out->sentBefore = true;
+  }
+  lastSentTime = now;
+  txCurrent = -1;
+  txOffset = 0;
+}
+
+/*
+  @desc Replaces the timestamp of a packet being sent again with the time now, so it is not
+  taken as stale for the time it waited for its acknowledgement
+  @param OutgoingPacket *out
+  @return
+*/
+void BluetoothLink::restampPacket(OutgoingPacket *out) {
+  const String &packet = out->packet;
+  int bodyStart = packet.indexOf(checksumEndMarker) + 1;
+  int stampAt = packet.indexOf(timestampMarker);
+  int dataAt = packet.indexOf(dataStartMarker);
+  if (bodyStart == 0 || stampAt < 0 || dataAt < stampAt) {
+    return;
+  }
+  String body = packet.substring(bodyStart, stampAt + 1);
+  appendTimestamp(body, (uint32_t)micros());
+  body.concat(packet.substring(dataAt, packet.length() - 1));
+  out->packet = framePacket(body);
+}
+
+/*
+  @desc Adds a timestamp as timestampDigits hex digits, with leading zeros, so a packet stamped
+  again is no longer than the one send() checked
+  @param String &body
+  @param uint32_t timestamp
+  @return
+*/
+void BluetoothLink::appendTimestamp(String &body, uint32_t timestamp) {
+  for (int shift = (timestampDigits - 1) * 4; shift >= 0; shift -= 4) {
+    byte digit = (timestamp >> shift) & 0x0F;
+    body.concat((char)(digit < 10 ? '0' + digit : 'a' + digit - 10));
+  }
+}
+
+/*
+  @desc Returns the priority of the packet being written, transfer frames are normal priority
+  @param
+  @return byte priority
+*/
+byte BluetoothLink::currentPriority() {
+  if (txCurrent == transferSlot) {
+    return PRIORITY_NORMAL;
+  }
+  return txQueue[txCurrent].priority;
+}
+
+/*
+  @desc Checks whether the Serial's transmit buffer can take the given number of bytes without
+  blocking. Ports that cannot tell always return 0, the same as a full buffer, so 0 only means
+  full once the port has reported some room; until then the bytes are written and may block.
+  @param unsigned int length
+  @return boolean - true if the bytes can be written now
+*/
+boolean BluetoothLink::canWrite(unsigned int length) {
+  int room = port->availableForWrite();
+  if (room > 0) {
+    portReportsRoom = true;
+  }
+  if (room > portRoomMax) {
+    portRoomMax = room;
+  }
+  return room >= (int)length || (room == 0 && !portReportsRoom);
+}
+
+/*
+  @desc Checks whether everything written has left the Serial's transmit buffer, as far as the
+  port can tell. Ports that cannot tell are taken as empty.
+  @param
+  @return boolean
+*/
+boolean BluetoothLink::transmitBufferEmpty() {
+  canWrite(0);
+  return !portReportsRoom || port->availableForWrite() >= portRoomMax;
+}
+
+/*
+  @desc Sends again, or gives up on, the packets whose acknowledgement is overdue
+  @param unsigned long now - millis()
+  @return
+*/
+void BluetoothLink::checkAckTimeouts(unsigned long now) {
+  for (int i = 0; i < sendQueueLength; i++) {
+    OutgoingPacket *out = txQueue + i;
+    if (out->state != SLOT_WAITING_ACK) {
+      continue;
+    }
+
+    boolean urgent = out->priority == PRIORITY_URGENT;
+    unsigned long timeout = urgent ? urgentAckTimeout : ackTimeout;
+    int attempts = urgent ? urgentTransmitAttempts : transmitAttempts;
+    if (now - out->sentTime < timeout) {
+      continue;
+    }
+
+    if (out->attempts < attempts) {
+      out->state = SLOT_QUEUED;
+      stats.retransmits++;
+    } else if ((long)(lastHeardTime - out->sentTime) < 0 && linkState == LINK_UP) {
+      // nothing heard since it was sent, the link may be gone without the module saying so:
+      // held until the other device is heard from, or linkLost() queues it again
+      continue;
+    } else {
+      finishPacket(i, false, now);
+      if (includeErrorMessage) {
+        debugPort->println(F("No acknowledgement received"));
+      }
+    }
+  }
+}
+
+/*
+  @desc Removes a packet from the queue once it is acknowledged or given up on
+  @param int slot
+  @param boolean delivered
+  @param unsigned long now - millis()
+  @return
+*/
+void BluetoothLink::finishPacket(int slot, boolean delivered, unsigned long now) {
+  OutgoingPacket *out = txQueue + slot;
+  if (delivered) {
+    stats.packetsSent++;
+    if (out->priority == PRIORITY_URGENT && now - out->queuedTime > stats.worstUrgentLatency) {
+      stats.worstUrgentLatency = now - out->queuedTime;
+    }
+  } else {
+    stats.sendFailures++;
+  }
+  if (slot == txCurrent) {
+    txCurrent = -1;
+    txOffset = 0;
+  }
+  out->state = SLOT_EMPTY;
+  out->packet = "";
+  txDelivered[out->priority] = delivered;
+  txStale[out->priority] = false;
+}
+
+/*
+  @desc Tells the other device a packet was received, with <NAK> if it was too old to pass on
+  @param int priority - of the packet
+  @param int sequence - of the packet, or noSequence
+  @return
+*/
+void BluetoothLink::sendAcknowledge(int priority, int sequence) {
+  String ack = ackStale[priority] ? "<NAK" : "<ACK";
+  if (sequence != noSequence) {
+    ack.concat(priority == PRIORITY_URGENT ? urgentSequenceMarker : sequenceMarker);
+    ack.concat(String(sequence));
+  }
+  ack.concat(packetEndMarker);
+
+  transmit(ack);
+  stats.bytesSent += ack.length();
+  ackDue[priority] = false;
+}
+
+//CRC-8 - based on the CRC8 formulas by Dallas/Maxim
+//code released under the therms of the GNU GPL 3.0 license
+byte BluetoothLink::CRC8(const byte *data, size_t len, byte crc) {
+  while (len--) {
+    byte extract = *data++;
+    for (byte tempI = 8; tempI; tempI--) {
+      byte sum = (crc ^ extract) & 0x01;
+      crc >>= 1;
+      if (sum) {
+        crc ^= 0x8C;
+      }
+      extract >>= 1;
+    }
+  }
+  return crc;
+}
+
+
+/************************************************************************************************************************/
+/************************/
+/*     Receive          */
+/************************/
+/************************************************************************************************************************/
+
+/*
+  @desc Returns true once for every packet received since the last call.
+  If several packets arrive before this is called, only the latest is kept.
+  @param
+  @return boolean - true if there is a new transmission
+  @return boolean - false if there is no new transmission
+*/
+boolean BluetoothLink::receivedNewData() {
+  boolean received = newData;
+  newData = false;
+  return received;
+}
+
+/*
+  @desc Decodes the given packet as if it had just been read from the Bluetooth Serial, for
+  testing the receive path without the other device. It is answered like any other packet.
+  @param const String &packet - with its packet markers
+  @return boolean - false if it is not a packet, or part of one is being read from the Serial
+*/
+boolean BluetoothLink::receivePacket(const String &packet) {
+  int len = packet.length();
+  if (rxInPacket || len < 2 || len > maxPacketLength || packet.charAt(0) != packetStartMarker ||
+      packet.charAt(len - 1) != packetEndMarker) {
+    return false;
+  }
+  memcpy(rxBuffer, packet.c_str(), len);
+  rxLength = len;
+  rxStartMicros = (uint32_t)micros();
+  processPacket(millis());
+  rxLength = 0;
+  return true;
+}
+
+/*
+  @desc Returns a pointer to the array holding the last received transmission.
+  The array is freed by the next received transmission or clearMemory()
+  @param
+  @return String *pointer
+*/
+String *BluetoothLink::getData() {
+  return storedTransmission;
+}
+
+/*
+  @desc Returns the number of elements in the last received transmission
+  @param
+  @return int storedSize
+*/
+int BluetoothLink::getDataSize() {
+  return storedSize;
+}
+
+/*
+  @desc Delete the last received transmission to free up memory
+  @param
+  @return
+*/
+void BluetoothLink::clearMemory() {
+  delete[] storedTransmission;
+  storedTransmission = NULL;
+  storedSize = 0;
+}
+
+/*
+  @desc Reads the bytes available on the Bluetooth Serial into the packet buffer.
+  Stops after maxBytesPerUpdate bytes or one complete packet.
+  @param unsigned long now - millis()
+  @return
+*/
+void BluetoothLink::readFromBTBuffer(unsigned long now) {
+  // the rest of the packet is not coming
+  if (rxInPacket && now - rxLastByteTime >= packetTimeout) {
+    dropPacket(F("Read from buffer TIMEOUT - no end packet marker"));
+  }
+
+  int bytesRead = 0;
+  while (bytesRead < maxBytesPerUpdate && port->available() > 0) {
+    char fromBT = port->read();
+    bytesRead++;
+    stats.bytesReceived++;
+    if (captureRing != NULL) {
+      captureStage[captureStaged++] = fromBT;
+    }
+
+    if (fromBT == packetStartMarker) {
+      // a new start marker means the end of the last packet was lost
+      if (rxInPacket) {
+        dropPacket(F("Read from buffer - no end packet marker"));
+      }
+      rxInPacket = true;
+      rxStartMicros = (uint32_t)micros();
+    } else if (!rxInPacket) {
+      // not part of a packet, may be a notification from the module
+      readModuleByte(fromBT, now);
+      continue;
+    }
+
+    // too long to be a valid packet, drop it rather than waiting for its end
+    if (rxLength >= maxPacketLength) {
+      dropPacket(F("Read from buffer - packet too long"));
+      continue;
+    }
+
+    rxBuffer[rxLength++] = fromBT;
+    rxLastByteTime = now;
+
+    if (fromBT == packetEndMarker) {
+      processPacket(now);
+      rxLength = 0;
+      rxInPacket = false;
+      break;
+    }
+  }
+  captureFlush();
+}
+
+/*
+  @desc Discards the partly received packet
+  @param const __FlashStringHelper *reason - error message, in F()
+  @return
+*/
+void BluetoothLink::dropPacket(const __FlashStringHelper *reason) {
+  if (includeErrorMessage) {
+    debugPort->println(reason);
+  }
+  captureEvent(EVENT_DROPPED);
+  stats.droppedPackets++;
+  rxLength = 0;
+  rxInPacket = false;
+}
+
+/*
+  @desc Handles a complete packet in the packet buffer: acknowledgement, or checksum, acknowledge and store
+  or pass to its message handler
+  @param unsigned long now - millis()
+  @return
+*/
+void BluetoothLink::processPacket(unsigned long now) {
+  rxBuffer[rxLength] = '\0';
+  if (testingMessages) {
+    debugPort->println(F("\nData read from BTSerial:"));
+    debugPort->println(rxBuffer);
+  }
+
+  int priority;
+  int sequence;
+
+  // acknowledgement of transfer frames, <ACK~id,offset>
+  if (strncmp(rxBuffer, "<ACK~", 5) == 0) {
+    heard(now);
+    captureEvent(EVENT_ACK);
+    receivedTransferAcknowledge(rxBuffer + 5, now);
+    return;
+  }
+
+  // acknowledgement of a packet sent, <ACK>, <ACK%sequence> or <ACK^sequence>, or <NAK...>
+  // for one that was too old to be passed on
+  if (strncmp(rxBuffer, "<ACK", 4) == 0 || strncmp(rxBuffer, "<NAK", 4) == 0) {
+    heard(now);
+    captureEvent(EVENT_ACK);
+    sequence = readSequence(rxBuffer + 4, &priority);
+    receivedAcknowledge(priority, sequence, rxBuffer[1] == 'N', now);
+    return;
+  }
+
+  // heartbeat, <PING%sequence>, and its answer <PONG%sequence>
+  if (strncmp(rxBuffer, "<PING", 5) == 0) {
+    heard(now);
+    captureEvent(EVENT_HEARTBEAT);
+    pongDue = true;
+    pongDueTime = now;
+    pongSequence = readSequence(rxBuffer + 5, &priority);
+    pingReceivedMicros = rxStartMicros;
+    return;
+  }
+  if (strncmp(rxBuffer, "<PONG", 5) == 0) {
+    heard(now);
+    captureEvent(EVENT_HEARTBEAT);
+    receivedHeartbeatReply(readSequence(rxBuffer + 5, &priority), strchr(rxBuffer + 5, ','));
+    return;
+  }
+
+  // packet without packet markers
+  char *data = rxBuffer + 1;
+  int len = rxLength - 2;
+
+  // check data integrity
+  if (!confirmCheckSum(data, len)) {
+    stats.checksumErrors++;
+    captureEvent(EVENT_CHECKSUM);
+    if (testingMessages) {
+      debugPort->println(F("failed checksum"));
+    }
+    return;
+  }
+
+  heard(now);
+
+  // remove checksum, confirmCheckSum() has checked it ends within the packet
+  char *body = skipCheckSum(data);
+  int bodyLength = len - (body - data);
+
+  if (*body == transferMarker) {
+    captureEvent(EVENT_TRANSFER);
+    processTransferFrame(body, bodyLength);
+    return;
+  }
+
+  sequence = readSequence(body, &priority);
+  ackDue[priority] = true;
+  ackStale[priority] = false;
+  ackSequence[priority] = sequence;
+
+  // sent again because the acknowledgement was lost, already passed on
+  if (sequence != noSequence && sequence == rxLastSequence[priority]) {
+    stats.duplicatePackets++;
+    captureEvent(EVENT_DUPLICATE);
+    return;
+  }
+
+  // age of the data, from the timestamp between the sequence number and the data
+  rxLatency = noLatency;
+  for (char *c = body; c < body + bodyLength && *c != dataStartMarker; c++) {
+    uint32_t timestamp;
+    if (*c == timestampMarker && readHex(c + 1, &timestamp) > 0 && isClockSynced()) {
+      rxLatency = (int32_t)((uint32_t)micros() - toLocalMicros(timestamp));
+      if (rxLatency < 0) {
+        rxLatency = 0;
+      }
+      break;
+    }
+  }
+  // answered with <NAK>, and not taken as a repeat if it is sent again with a new timestamp
+  if (maxDataAge > 0 && rxLatency != noLatency && (unsigned long)rxLatency > maxDataAge * 1000) {
+    ackStale[priority] = true;
+    stats.stalePackets++;
+    captureEvent(EVENT_STALE);
+    if (includeErrorMessage) {
+      debugPort->println(F("Stale packet dropped"));
+    }
+    return;
+  }
+
+  rxLastSequence[priority] = sequence;
+
+  // decrypt - TODO, packets are currently sent as plain text
+
+  stats.packetsReceived++;
+  captureEvent(EVENT_PASSED);
+  newData = true;
+
+  // straight to the handler for its type, without storing it
+  if (handlers != NULL) {
+    dispatchMessage(body, bodyLength, priority);
+    return;
+  }
+
+  rebuildData(body, bodyLength);
+  if (testingMessages) {
+    debugPort->println(F("\nData after being rebuilt:"));
+    for (int i = 0; i < storedSize; i++) {
+      debugPort->println(*(storedTransmission + i));
+    }
+  }
+}
+
+/*
+  @desc Reads the sequence field at the start of a packet or acknowledgement, %sequence or ^sequence
+  @param const char *field - first character after the checksum, or after ACK
+  @param int *priority - set to the priority given by the field's marker
+  @return int - sequence number, noSequence if there is no valid field
+*/
+int BluetoothLink::readSequence(const char *field, int *priority) {
+  *priority = PRIORITY_NORMAL;
+  if (*field != sequenceMarker && *field != urgentSequenceMarker) {
+    return noSequence;
+  }
+
+  int sequence = 0;
+  int digits = 0;
+  for (const char *c = field + 1; *c >= '0' && *c <= '9'; c++) {
+    sequence = sequence * 10 + (*c - '0');
+    digits++;
+    if (digits > 3) {
+      return noSequence;
+    }
+  }
+  if (digits == 0 || sequence > 255) {
+    return noSequence;
+  }
+
+  if (*field == urgentSequenceMarker) {
+    *priority = PRIORITY_URGENT;
+  }
+  return sequence;
+}
+
+/*
+  @desc Takes the acknowledged packet off the queue. One answered with <NAK> was too old for the
+  other device to pass on, and is given up on so the sketch can send what is current instead.
+  @param int priority - of the acknowledged packet
+  @param int sequence - of the acknowledged packet, noSequence for the oldest normal packet sent
+  @param boolean stale - answered with <NAK>
+  @param unsigned long now - millis()
+  @return
+*/
+void BluetoothLink::receivedAcknowledge(int priority, int sequence, boolean stale, unsigned long now) {
+  int acked = -1;
+  for (int i = 0; i < sendQueueLength; i++) {
+    OutgoingPacket *out = txQueue + i;
+    // an acknowledgement can arrive after the packet was queued to be sent again
+    if (out->state == SLOT_EMPTY || out->attempts == 0 || out->priority != priority) {
+      continue;
+    }
+    if (sequence == noSequence) {
+      if (acked < 0 || (long)(out->order - txQueue[acked].order) < 0) {
+        acked = i;
+      }
+    } else if (out->sequence == sequence) {
+      acked = i;
+    }
+  }
+  if (acked < 0) {
+    return;
+  }
+  finishPacket(acked, !stale, now);
+  if (stale) {
+    stats.staleSends++;
+    txStale[priority] = true;
+    if (includeErrorMessage) {
+      debugPort->println(F("Packet too old for the other device"));
+    }
+  }
+}
+
+/*
+  @desc Reads the checksum of given data
+  @param const char *data - packet without packet markers
+  @param int len - length of data
+  @return boolean - TRUE if data and checksum matches
+  @return boolean - FALSE if data and checksum does not match
+*/
+boolean BluetoothLink::confirmCheckSum(const char *data, int len) {
+  // The checksum is the first field of the data, the decimal CRC8 wrapped in checksum markers
+  // e.g. &76*!#0$#1$#2$#3$@
+  if (len < 3 || *data != checksumStartMarker) {
+    return false;
+  }
+
+  // Read the given checksum
+  int givenCheckSum = 0;
+  int csEnd = 1;
+  while (csEnd < len && csEnd <= 4 && *(data + csEnd) != checksumEndMarker) {
+    char c = *(data + csEnd);
+    if (c < '0' || c > '9') {
+      return false;
+    }
+    givenCheckSum = givenCheckSum * 10 + (c - '0');
+    csEnd++;
+  }
+  if (csEnd < 2 || csEnd > 4 || csEnd >= len) {
+    return false;
+  }
+
+  // Calculate the checksum on the data following the checksum
+  uint8_t calculatedChecksum = CRC8((const byte *)data + csEnd + 1, len - csEnd - 1);
+
+  // Compare the extracted checksum and the calculated checksum
+  return calculatedChecksum == givenCheckSum;
+}
+
+/*
+  @desc Finds the data after the checksum field, without copying it
+  @param char *data - packet without packet markers, accepted by confirmCheckSum()
+  @return char * - first character after the checksum end marker
+*/
+char *BluetoothLink::skipCheckSum(char *data) {
+  return strchr(data, checksumEndMarker) + 1;
+}
+
+/*
+  @desc Splits the data into its lines, without their markers, and stores them for access through getData()
+  @param char *data - data without checksum
+  @param int len - length of data
+  @return
+*/
+void BluetoothLink::rebuildData(char *data, int len) {
+  // free the previous transmission
+  clearMemory();
+
+  // calculate array size, counting only lines that have both markers
+  int lineCount = 0;
+  boolean inLine = false;
+  for (int i = 0; i < len; i++) {
+    if (!inLine && *(data + i) == lineStartMarker) {
+      inLine = true;
+    } else if (inLine && *(data + i) == lineEndMarker) {
+      inLine = false;
+      lineCount++;
+    }
+  }
+
+  storedTransmission = new String[lineCount];
+
+  // store each line, ending it in place so it can be copied without a substring
+  int lineStart = -1;
+  for (int i = 0; i < len && storedSize < lineCount; i++) {
+    if (lineStart < 0 && *(data + i) == lineStartMarker) {
+      lineStart = i + 1;
+    } else if (lineStart >= 0 && *(data + i) == lineEndMarker) {
+      *(data + i) = '\0';
+      *(storedTransmission + storedSize) = data + lineStart;
+      *(data + i) = lineEndMarker;
+      storedSize++;
+      lineStart = -1;
+    }
+  }
+}
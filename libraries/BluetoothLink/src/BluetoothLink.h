@@ -0,0 +1,496 @@
+/*
+  BluetoothLink
+  The packet protocol used between the Uno and the Mega, bound to one Serial port.
+
+  Every link owns its parser, buffers, timers and counters, so several links can run from the
+  same loop, e.g. Serial1, Serial2 and Serial3 on the Mega. update() never waits on the port:
+  each call reads at most maxBytesPerUpdate bytes and writes at most one BLE chunk.
+
+  Packet format:
+    <&checksum*%sequence!#line$#line$...@>
+  The other device answers every packet it accepts with <ACK%sequence>. Urgent packets use '^'
+  in place of '%'; they are sent ahead of queued normal packets, cutting short one that is part
+  way out (the receiver drops it on the next '<' and it is sent again), and are acknowledged
+  sooner. Packets without the sequence field are accepted and answered with <ACK>. A packet with
+  the sequence number of the last one passed on is a repeat, acknowledged but not passed on; the
+  numbers start from a random one, so a reset sender is unlikely to repeat its last number.
+
+  Bulk transfers stream a byte payload of any length in frames of the same form:
+    <&checksum*~id,offset!bytes@>     the first frame is ~id,0,totalLength
+  where '<', '>' and '\' in the bytes are sent as '\' followed by the byte XOR 0x20. The receiver
+  answers <ACK~id,offset> with the number of bytes it has taken, and the sender keeps only the
+  bytes from that offset on, at most transferWindowLength. Frames are sent whenever no queued
+  packet is waiting, so packets still get through during a transfer.
+
+  A link that has sent nothing for heartbeatInterval sends <PING%n>, answered with <PONG%n>, to
+  keep up its round trip and loss estimates. Nothing heard for linkTimeout, or OK+LOST from the
+  module, means the link is lost. With a peer MAC set, update() then sends AT+CON until the
+  module answers OK+CONN, without waiting for the answer, but only once the module has said
+  OK+LOST or its STATE pin has been seen low: a module still connected sends AT+CON to the
+  other device as data, so a link that has only gone quiet waits to be heard from again.
+
+  The answer to a heartbeat is <PONG%n,t2,t3>, the other device's micros() in hex when the
+  heartbeat arrived and when it was answered. As in NTP, these and the heartbeat's own send and
+  receive times give the offset of the other device's clock, kept from the heartbeat with the
+  shortest round trip of the last clockFilterLength, and its drift. With timestampPackets set,
+  packets carry the sender's micros() at send() as =hex, 8 digits, after the sequence number, so the
+  receiver can tell how old the data is. A packet sent again is stamped again, and one older than
+  the receiver's maxDataAge is answered with <NAK%sequence>, so the sender knows it was not
+  passed on.
+
+  beginCapture() records the raw bytes read from and written to the Bluetooth Serial, and what
+  was made of each packet received, in a ring of records drained with drainCapture(), see
+  BluetoothLinkCapture.cpp for the format. HostSim/Replay feeds a capture back through the
+  receive path.
+
+  With setPairingCache(), setupModule() keeps the module's address, role and name, the peer MAC
+  and the baud rate in EEPROM. On the next boot one AT+ADDR? tells whether it is the same module:
+  if so, and it already has the role and name asked for, nothing is written to it and AT+CON goes
+  to the cached peer straight away. See BluetoothLinkPairing.cpp.
+
+  With setHandlers(), the first line of a packet is its message type, a number, and update()
+  passes the packet to the handler at that index of the table as it is read, or to the fallback
+  handler. The lines are ended in place in the packet buffer, nothing is copied, and getData()
+  is left empty. See BluetoothLinkDispatch.cpp.
+*/
+
+#ifndef BluetoothLink_h
+#define BluetoothLink_h
+
+#include <Arduino.h>
+
+#define packetStartMarker       '<'
+#define packetEndMarker         '>'
+
+#define dataStartMarker         '!'
+#define dataEndMarker           '@'
+
+#define lineStartMarker         '#'
+#define lineEndMarker           '$'
+
+#define checksumStartMarker     '&'
+#define checksumEndMarker       '*'
+
+#define sequenceMarker          '%'   // normal packet sequence number
+#define urgentSequenceMarker    '^'   // urgent packet sequence number
+#define timestampMarker         '='   // sender's micros() at send(), in hex
+#define timestampDigits         8     // hex digits of a timestamp, fixed so stamping it again keeps its length
+#define checksumDigits          3     // most decimal digits of a checksum
+
+#define PRIORITY_NORMAL         0     // telemetry, status, test data
+#define PRIORITY_URGENT         1     // control commands, e.g. stop
+#define numPriorities           2
+
+#define noSequence              -1    // packet without a sequence number
+#define noLatency               -1    // packet without a timestamp, or the clocks are not synchronised yet
+
+#define transferMarker          '~'   // bulk transfer frame, or its acknowledgement
+#define transferEscape          '\\'  // next byte in a transfer frame is XOR 0x20
+
+#define maxPacketLength         256   // longest packet accepted from the Bluetooth Serial
+#define bleChunkLength          20    // BLE 4.0 standards - can only transmit 20 bytes per packet
+#define maxAckLength            9     // <ACK^255>
+#define maxBytesPerUpdate       32    // most bytes read from the Bluetooth Serial by one update()
+#define sendQueueLength         4     // packets queued or waiting for acknowledgement, each held as a String
+#define transferWindowLength    512   // bytes of a transfer held until acknowledged, allocated by beginTransfer()
+#define transferFrameLength     220   // most escaped payload bytes in one transfer frame, fits maxPacketLength
+#define maxTransferAckLength    19    // <ACK~255,999999999>
+#define maxHeartbeatLength      28    // <PONG%255,ffffffff,ffffffff>
+#define transferSlot            sendQueueLength   // txCurrent while a transfer frame is being written
+
+#define packetTimeout           5000  // ms without a byte before a partial packet is dropped
+#define ackTimeout              1500  // ms to wait for acknowledgement before sending again
+#define urgentAckTimeout        300   // ms to wait for acknowledgement of an urgent packet
+#define atTimeout               2000  // ms to wait for the start of an AT response
+
+#define heartbeatInterval       1000  // ms without sending before a heartbeat, and to wait for its answer
+#define linkTimeout             3500  // ms without hearing the other device before the link is lost
+#define reconnectTimeout        12000 // ms to wait for the module to answer AT+CON
+#define reconnectRetryDelay     500   // ms between a failed AT+CON and the next
+#define atBufferLength          12    // last bytes received outside packets, for the module's notifications
+#define atCommandGap            100   // ms without writing before an AT command, so it is not run into data
+#define atNotificationGap       50    // ms after OK+CONN without more bytes before it is taken as connected
+#define clockSyncInterval       5000  // ms between heartbeats while busy sending, to keep the clock offset up
+#define maxReplyDelay           50    // ms a heartbeat's answer waits for the transmit buffer to empty
+#define clockFilterLength       4     // clock samples kept, the one with the shortest round trip is used
+#define clockDriftBaseline      10000 // ms between the clock samples the drift is measured over
+
+#define macLength               12    // hex digits in a module address
+#define maxNameLength           12    // longest module name the HM-10 takes
+#define pairingVersion          1     // of the pairing cache layout in EEPROM
+#define noPairingCache          -1
+#define atReplyGap              30    // ms without a byte after which an AT answer is complete
+
+#define maxMessageLines         16    // lines passed to a handler, a packet with more goes to the fallback cut short
+#define maxMessageType          255
+#define noMessageType           -1    // first line is not a message type
+
+#define captureRecordLength     64    // most bytes in one capture record
+#define captureVersion          1
+#define CAPTURE_RX              0     // record types
+#define CAPTURE_TX              1
+#define CAPTURE_EVENT           2
+#define EVENT_PASSED            'P'   // capture events, what was made of a packet received
+#define EVENT_DUPLICATE         'D'
+#define EVENT_STALE             'S'
+#define EVENT_CHECKSUM          'C'
+#define EVENT_DROPPED           'X'   // partial packet dropped
+#define EVENT_ACK               'A'   // acknowledgement, of a packet or a transfer frame, or <NAK>
+#define EVENT_HEARTBEAT         'H'   // heartbeat or its answer
+#define EVENT_TRANSFER          'T'   // transfer frame
+
+
+/*
+  Counters kept by each link, see BluetoothLink::getStats()
+*/
+struct BluetoothLinkStats {
+  unsigned long packetsSent;        // packets acknowledged by the other device
+  unsigned long packetsReceived;    // packets that passed the checksum
+  unsigned long bytesSent;
+  unsigned long bytesReceived;
+  unsigned long checksumErrors;
+  unsigned long droppedPackets;     // too long, cut short by a new packet, or timed out part way
+  unsigned long duplicatePackets;   // sent again after the acknowledgement was lost, not passed on
+  unsigned long retransmits;
+  unsigned long sendFailures;       // packets never acknowledged
+  unsigned long preemptions;        // normal packets cut short to send something urgent
+  unsigned long worstUrgentLatency; // longest ms from send() to acknowledgement of an urgent packet
+  unsigned long transferBytesSent;  // transfer payload acknowledged by the other device
+  unsigned long transferBytesReceived;
+  unsigned long stalePackets;       // older than maxDataAge, answered with <NAK> and not passed on
+  unsigned long staleSends;         // packets answered with <NAK>, given up on
+  unsigned long unhandledMessages;  // passed to the fallback handler, or dropped if there is none
+  unsigned long truncatedMessages;  // more than maxMessageLines lines, the rest not passed on
+};
+
+/*
+  A packet passed to a message handler, see BluetoothLink::setHandlers().
+  The lines are in the link's packet buffer and are only valid until the handler returns.
+*/
+struct BluetoothMessage {
+  int type;                         // first line as a number, noMessageType if it is not one
+  const char *const *lines;         // lines[0] is the type, as sent
+  int lineCount;                    // at most maxMessageLines
+  boolean truncated;                // the packet had more lines, only ever passed to the fallback
+  byte priority;
+  long latency;                     // as getDataLatency()
+};
+
+/*
+  Called by update() for each packet received, must not call update() itself. send() may be called.
+*/
+typedef void (*BluetoothHandler)(const BluetoothMessage &message);
+
+/*
+  Link quality estimated from heartbeats, and reconnection times, see BluetoothLink::getLinkQuality()
+*/
+struct BluetoothLinkQuality {
+  unsigned long rtt;                // smoothed heartbeat round trip, us
+  unsigned long rttVariation;       // smoothed difference of each round trip from rtt, us
+  byte lossPercent;                 // of the last 32 heartbeats
+  unsigned long heartbeatsSent;
+  unsigned long heartbeatsLost;
+  unsigned long disconnects;
+  unsigned long reconnectAttempts;  // AT+CON sent by update()
+  unsigned long lastReconnectTime;  // ms from the link being lost to it being back
+  unsigned long worstReconnectTime;
+};
+
+/*
+  Module settings kept in EEPROM between boots, see BluetoothLink::getPairing()
+*/
+struct BluetoothLinkPairing {
+  char address[macLength + 1];      // of this board's module, empty if not known
+  char peerMAC[macLength + 1];      // connected to by a central
+  char name[maxNameLength + 1];
+  byte role;                        // 0 peripheral, 1 central
+  uint32_t baud;                    // the settings were read at
+};
+
+
+class BluetoothLink {
+  public:
+    BluetoothLink(Stream &port, uint8_t statusPin);
+    ~BluetoothLink();
+
+    void update();
+
+    // Transmit
+    boolean send(String data[], int arraySize, byte priority = PRIORITY_NORMAL);
+    boolean isSending();
+    boolean isSending(byte priority);
+    boolean lastSendDelivered(byte priority = PRIORITY_NORMAL);
+    void cancelSend(byte priority);
+    int transmitAttempts;
+    int urgentTransmitAttempts;
+
+    // Bulk transfer
+    boolean beginTransfer(unsigned long totalLength);
+    size_t write(const byte *data, size_t len);
+    boolean endTransfer();
+    void cancelTransfer();
+    boolean isTransferring();
+    boolean transferStalled();
+    void resumeTransfer();
+    boolean transferDelivered();
+    unsigned long getTransferAcked();
+    int transferAttempts;
+
+    // Receive
+    boolean receivedNewData();
+    boolean receivePacket(const String &packet);
+    String *getData();
+    int getDataSize();
+    void clearMemory();
+    boolean receivedTransferData();
+    const byte *getTransferData();
+    int getTransferDataSize();
+    unsigned long getTransferOffset();
+    unsigned long getTransferLength();
+    void setHandlers(const BluetoothHandler handlers[], int count, BluetoothHandler fallback);
+
+    // Settings & status
+    boolean getConnectionStatus();
+    boolean isLinkUp();
+    boolean connect();
+    boolean autoReconnect;
+    void setPeerMAC(const String &mac);
+    const String &getPeerMAC();
+    boolean changeName(String newName);
+    boolean changeRole(int role);
+    boolean canDoAT();
+    String atResponse();
+
+    // Pairing cache
+    void setPairingCache(int eepromAddress, unsigned long baud);
+    boolean setupModule(int role, const String &fullName);
+    boolean hasPairing();
+    const BluetoothLinkPairing &getPairing();
+    void clearPairing();
+
+    const BluetoothLinkStats &getStats();
+    const BluetoothLinkQuality &getLinkQuality();
+    void setDebug(Print &debugPort, boolean errorMessages, boolean testingMessages);
+
+    // Capture
+    boolean beginCapture(unsigned int size);
+    void endCapture();
+    boolean isCapturing();
+    size_t drainCapture(Print &out);
+
+    // Clock sync & latency
+    boolean timestampPackets;
+    unsigned long maxDataAge;             // ms, 0 passes on timestamped packets however old
+    boolean isClockSynced();
+    long getClockOffset();
+    float getClockDrift();
+    uint32_t toLocalMicros(uint32_t peerMicros);
+    long getDataLatency();
+    boolean lastSendStale(byte priority = PRIORITY_NORMAL);
+
+    static String buildPacket(String data[], int arraySize, byte priority = PRIORITY_NORMAL, int sequence = noSequence,
+                              boolean stamped = false, uint32_t timestamp = 0);
+    static String framePacket(const String &body);
+    // stages of update() decoding a packet, public so HostSim/ReceivePath can time each one
+    static boolean confirmCheckSum(const char *data, int len);
+    static char *skipCheckSum(char *data);
+    void rebuildData(char *data, int len);
+    static byte CRC8(const byte *data, size_t len, byte crc = 0x00);
+    static boolean isATSucessfull(String response, String successFlags[], int numFlags);
+
+  private:
+    enum SlotState { SLOT_EMPTY, SLOT_QUEUED, SLOT_WAITING_ACK };
+    enum LinkState { LINK_UP, LINK_LOST, LINK_CONNECTING };
+
+    /*
+      A packet given to send(), kept until it is acknowledged or all attempts have timed out
+    */
+    struct OutgoingPacket {
+      String packet;
+      SlotState state;
+      byte priority;
+      byte sequence;
+      byte attempts;
+      boolean sentBefore;         // stamped again when sent again
+      unsigned long order;        // send order within the same priority
+      unsigned long queuedTime;
+      unsigned long sentTime;
+    };
+
+    Stream *port;
+    uint8_t statusPin;
+    String peerMAC;
+    BluetoothLinkPairing pairing;
+    int pairingAddress;                   // in EEPROM, noPairingCache if not kept
+    boolean pairingValid;
+
+    // Receive
+    char rxBuffer[maxPacketLength + 1];
+    int rxLength;
+    boolean rxInPacket;
+    unsigned long rxLastByteTime;
+
+    String *storedTransmission;
+    int storedSize;
+    boolean newData;
+    const BluetoothHandler *handlers;     // indexed by message type, NULL to store packets for getData()
+    int handlerCount;
+    BluetoothHandler fallbackHandler;
+    const char *messageLines[maxMessageLines];
+    boolean ackDue[numPriorities];
+    boolean ackStale[numPriorities];      // the acknowledgement due is <NAK>, the packet was too old
+    int ackSequence[numPriorities];       // of the packet to acknowledge
+    int rxLastSequence[numPriorities];    // of the last packet passed on
+
+    // Transmit
+    OutgoingPacket txQueue[sendQueueLength];
+    int txCurrent;                        // packet being written, -1 if none
+    unsigned int txOffset;
+    byte txSequence;
+    unsigned long txOrder;
+    boolean txDelivered[numPriorities];   // whether the last packet of each priority was acknowledged
+    boolean txStale[numPriorities];       // whether it was answered with <NAK> instead
+    boolean portReportsRoom;              // availableForWrite() has returned more than 0
+    int portRoomMax;                      // most availableForWrite() has returned, the empty transmit buffer
+
+    // Bulk transfer being sent
+    byte *transferWindow;                 // bytes from transferAcked to transferWritten, NULL if no transfer
+    char *transferFrame;                  // frame being written
+    unsigned int transferFrameSize;
+    unsigned long transferFrameOffset;    // of the first byte in the frame
+    byte transferId;
+    unsigned long transferLength;
+    unsigned long transferWritten;        // given to write()
+    unsigned long transferSent;           // put in a frame
+    unsigned long transferAcked;          // taken by the other device
+    unsigned long transferTimer;          // last frame sent or acknowledgement that moved on
+    int transferTimeouts;                 // in a row, without the acknowledged offset moving on
+    boolean transferIsStalled;
+    boolean transferOk;
+
+    // Bulk transfer being received
+    int rxTransferId;                     // -1 if none
+    unsigned long rxTransferLength;
+    unsigned long rxTransferTaken;        // bytes passed on by receivedTransferData()
+    const byte *rxChunk;                  // in rxBuffer, valid until the next update()
+    int rxChunkSize;
+    boolean rxChunkReady;
+    boolean transferAckDue;
+
+    BluetoothLinkStats stats;
+
+    // Link quality & reconnect
+    LinkState linkState;
+    unsigned long lastHeardTime;          // last valid packet, acknowledgement or heartbeat received
+    unsigned long lastSentTime;           // last packet or transfer frame written
+    unsigned long lastWriteTime;          // last byte written, the module reads AT commands only after a gap
+    unsigned long linkLostTime;
+    unsigned long reconnectTime;          // AT+CON sent, or answered with a failure
+    boolean heartbeatWaiting;             // for its answer
+    byte heartbeatSequence;
+    unsigned long heartbeatSentTime;
+    unsigned long heartbeatSentMicros;
+    unsigned long heartbeatHistory;       // a bit set for each of the last 32 heartbeats lost
+    byte heartbeatCount;                  // in heartbeatHistory
+    boolean pongDue;
+    unsigned long pongDueTime;
+    int pongSequence;
+    char atBuffer[atBufferLength + 1];
+    byte atLength;
+    unsigned long atLastByteTime;
+    boolean atConnPending;                // OK+CONN received, OK+CONNA/F/E not ruled out yet
+    boolean moduleDisconnected;           // OK+LOST, or the STATE pin low, since the link was last up
+    BluetoothLinkQuality quality;
+
+    // Clock sync, offsets are the other device's micros() minus ours
+    struct ClockSample {
+      uint32_t offset;
+      unsigned long delay;                // round trip less the time the other device held the heartbeat, us
+      uint32_t time;                      // our micros() when the answer arrived
+    };
+    ClockSample clockFilter[clockFilterLength];
+    byte clockSamples;
+    byte clockNext;
+    float clockDrift;                     // ppm the other device's clock runs fast by
+    boolean clockDriftKnown;
+    uint32_t driftAnchorOffset;
+    uint32_t driftAnchorTime;
+    // Capture ring, records from captureTail to captureHead
+    byte *captureRing;
+    unsigned int captureSize;
+    unsigned int captureHead;
+    unsigned int captureTail;
+    unsigned int captureUsed;
+    uint32_t captureTailMicros;           // time of the oldest record, whose own delta is not used
+    uint32_t captureLastMicros;           // time of the newest record
+    unsigned long captureDropped;         // bytes of records dropped to make room since the last drain
+    byte *captureStage;                   // bytes read by this update(), recorded together, NULL if not capturing
+    byte captureStaged;
+
+    uint32_t rxStartMicros;               // start marker of the packet being read arrived
+    uint32_t pingReceivedMicros;
+    long rxLatency;
+
+    Print *debugPort;
+    boolean includeErrorMessage;
+    boolean testingMessages;
+
+    void readFromBTBuffer(unsigned long now);
+    void dropPacket(const __FlashStringHelper *reason);
+    void processPacket(unsigned long now);
+    void receivedAcknowledge(int priority, int sequence, boolean stale, unsigned long now);
+    static int readSequence(const char *field, int *priority);
+    void dispatchMessage(char *data, int len, byte priority);
+    static int readMessageType(const char *line);
+    void checkAckTimeouts(unsigned long now);
+    void transmitChunk(unsigned long now);
+    void restampPacket(OutgoingPacket *out);
+    static void appendTimestamp(String &body, uint32_t timestamp);
+    int nextQueued();
+    boolean canInterrupt(byte priority);
+    void interruptCurrent();
+    boolean canWrite(unsigned int length);
+    boolean transmitBufferEmpty();
+    void finishPacket(int slot, boolean delivered, unsigned long now);
+    void sendAcknowledge(int priority, int sequence);
+
+    byte currentPriority();
+    boolean nextTransferFrame();
+    void transferFrameSent(unsigned long now);
+    void transferFrameCut();
+    void checkTransferTimeout(unsigned long now);
+    void finishTransfer(boolean delivered);
+    void processTransferFrame(char *data, int len);
+    void receivedTransferAcknowledge(const char *field, unsigned long now);
+    void sendTransferAcknowledge();
+    static const char *readNumber(const char *field, unsigned long *value);
+
+    void heard(unsigned long now);
+    void checkLink(unsigned long now);
+    void linkLost(unsigned long now);
+    void linkRestored(unsigned long now);
+    void readModuleByte(char c, unsigned long now);
+    boolean atBufferEndsWith(const char *notification);
+    void sendHeartbeat(unsigned long now);
+    void sendHeartbeatReply();
+    void receivedHeartbeatReply(int sequence, const char *timestamps);
+    void finishHeartbeat(boolean answered);
+    void addClockSample(uint32_t t1, uint32_t t2, uint32_t t3, uint32_t t4);
+    int bestClockSample();
+    uint32_t clockOffsetAt(uint32_t now);
+    static int readHex(const char *field, uint32_t *value);
+    boolean loadPairing();
+    void savePairing();
+    String atQuery(const String &command);
+    void startConnect(unsigned long now);
+    void transmit(const uint8_t *data, size_t len);
+    void transmit(const String &s);
+    void captureBytes(byte type, const uint8_t *data, size_t len);
+    void captureEvent(char event);
+    void captureFlush();
+    void capturePut(byte b);
+    byte captureGet(unsigned int *at);
+    void captureDropOldest();
+};
+
+#endif
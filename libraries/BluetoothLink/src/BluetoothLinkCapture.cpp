@@ -0,0 +1,255 @@
+/*
+  BluetoothLink
+  Capture of the raw bytes read from and written to the Bluetooth Serial, see BluetoothLink.h.
+
+  Each record in the ring is
+    header    bits 7-6 the type, CAPTURE_RX, CAPTURE_TX or CAPTURE_EVENT, bits 5-0 the length - 1
+    delta     micros() since the record before, 7 bits per byte, least significant first, the
+              top bit set on every byte but the last
+    data      the bytes read or written, or the EVENT_ character
+  When the ring is full the oldest records are dropped to make room. The delta of the oldest
+  record is not used, its time is the one in the block header.
+
+  drainCapture() writes the ring as one block
+    "BLCP", captureVersion, time of the oldest record (4 bytes), bytes of records dropped since the
+    last drain (4 bytes), length of the records (2 bytes), the records, CRC8 of the records
+  with the numbers least significant byte first, and empties it. The block may be written between
+  text on the debug port, HostSim/Replay finds it by the "BLCP".
+*/
+
+#include "BluetoothLink.h"
+
+
+/************************************************************************************************************************/
+/************************/
+/*      Capture         */
+/************************/
+/************************************************************************************************************************/
+
+/*
+  @desc Starts recording into a ring of the given size, emptying the one before if any
+  @param unsigned int size - bytes, at least captureRecordLength + 6
+  @return boolean - false if the size is too small, or too large for the block length
+*/
+boolean BluetoothLink::beginCapture(unsigned int size) {
+  if (size < captureRecordLength + 6 || (unsigned long)size > 0xFFFF) {
+    if (includeErrorMessage) {
+      debugPort->println(F("Capture size not usable"));
+    }
+    return false;
+  }
+  delete[] captureRing;
+  if (captureStage == NULL) {
+    captureStage = new byte[maxBytesPerUpdate];
+  }
+  captureRing = new byte[size];
+  captureSize = size;
+  captureHead = 0;
+  captureTail = 0;
+  captureUsed = 0;
+  captureDropped = 0;
+  captureStaged = 0;
+  return true;
+}
+
+/*
+  @desc Stops recording and frees the ring and staging bytes, anything not drained is lost
+  @param
+  @return
+*/
+void BluetoothLink::endCapture() {
+  delete[] captureRing;
+  captureRing = NULL;
+  delete[] captureStage;
+  captureStage = NULL;
+  captureSize = 0;
+  captureUsed = 0;
+  captureStaged = 0;
+}
+
+/*
+  @desc Whether beginCapture() has been called without endCapture()
+  @param
+  @return boolean
+*/
+boolean BluetoothLink::isCapturing() {
+  return captureRing != NULL;
+}
+
+/*
+  @desc Writes the records as one block and empties the ring. Waits for the whole block to be
+  written, so best called when the loop can afford it, e.g. after a test.
+  @param Print &out - usually the debug port
+  @return size_t - bytes written, 0 if not capturing
+*/
+size_t BluetoothLink::drainCapture(Print &out) {
+  if (captureRing == NULL) {
+    return 0;
+  }
+  captureFlush();
+
+  byte header[15] = {'B', 'L', 'C', 'P', captureVersion};
+  for (int i = 0; i < 4; i++) {
+    *(header + 5 + i) = (captureTailMicros >> (8 * i)) & 0xFF;
+    *(header + 9 + i) = (captureDropped >> (8 * i)) & 0xFF;
+  }
+  *(header + 13) = captureUsed & 0xFF;
+  *(header + 14) = captureUsed >> 8;
+  size_t written = out.write(header, sizeof(header));
+
+  // the records wrap around the end of the ring at most once
+  unsigned int first = captureUsed;
+  if (captureTail + first > captureSize) {
+    first = captureSize - captureTail;
+  }
+  byte crc = CRC8(captureRing + captureTail, first);
+  written += out.write(captureRing + captureTail, first);
+  if (first < captureUsed) {
+    crc = CRC8(captureRing, captureUsed - first, crc);
+    written += out.write(captureRing, captureUsed - first);
+  }
+  written += out.write(crc);
+
+  captureHead = 0;
+  captureTail = 0;
+  captureUsed = 0;
+  captureDropped = 0;
+  return written;
+}
+
+/*
+  @desc Everything written to the Bluetooth Serial goes through here, to be captured
+  @param const uint8_t *data
+  @param size_t len
+  @return
+*/
+void BluetoothLink::transmit(const uint8_t *data, size_t len) {
+  port->write(data, len);
+  captureBytes(CAPTURE_TX, data, len);
+}
+
+void BluetoothLink::transmit(const String &s) {
+  transmit((const uint8_t *)s.c_str(), s.length());
+}
+
+/*
+  @desc Records bytes read or written, in as many records as it takes
+  @param byte type - CAPTURE_RX, CAPTURE_TX or CAPTURE_EVENT
+  @param const uint8_t *data
+  @param size_t len
+  @return
+*/
+void BluetoothLink::captureBytes(byte type, const uint8_t *data, size_t len) {
+  if (captureRing == NULL || len == 0) {
+    return;
+  }
+  // in the order they happened, what was read by this update() comes before what it wrote
+  if (type != CAPTURE_RX) {
+    captureFlush();
+  }
+
+  uint32_t now = (uint32_t)micros();
+  while (len > 0) {
+    size_t recordLength = len < captureRecordLength ? len : captureRecordLength;
+    uint32_t delta = captureUsed == 0 ? 0 : now - captureLastMicros;
+    unsigned int needed = 1 + recordLength;
+    for (uint32_t d = delta; d >= 0x80; d >>= 7) {
+      needed++;
+    }
+    needed++;
+
+    while (captureSize - captureUsed < needed) {
+      captureDropOldest();
+    }
+    if (captureUsed == 0) {
+      captureTailMicros = now;
+      delta = 0;
+    }
+
+    capturePut((type << 6) | (recordLength - 1));
+    while (delta >= 0x80) {
+      capturePut((delta & 0x7F) | 0x80);
+      delta >>= 7;
+    }
+    capturePut(delta);
+    for (size_t i = 0; i < recordLength; i++) {
+      capturePut(*(data + i));
+    }
+    captureLastMicros = now;
+    data += recordLength;
+    len -= recordLength;
+  }
+}
+
+/*
+  @desc Records what was made of a packet received, after the bytes read up to it
+  @param char event - EVENT_
+  @return
+*/
+void BluetoothLink::captureEvent(char event) {
+  if (captureRing == NULL) {
+    return;
+  }
+  captureFlush();
+  byte e = event;
+  captureBytes(CAPTURE_EVENT, &e, 1);
+}
+
+/*
+  @desc Records the bytes read by this update() so far
+  @param
+  @return
+*/
+void BluetoothLink::captureFlush() {
+  if (captureStaged == 0) {
+    return;
+  }
+  byte staged = captureStaged;
+  captureStaged = 0;
+  captureBytes(CAPTURE_RX, captureStage, staged);
+}
+
+void BluetoothLink::capturePut(byte b) {
+  *(captureRing + captureHead) = b;
+  captureHead = (captureHead + 1) % captureSize;
+  captureUsed++;
+}
+
+byte BluetoothLink::captureGet(unsigned int *at) {
+  byte b = *(captureRing + *at);
+  *at = (*at + 1) % captureSize;
+  return b;
+}
+
+/*
+  @desc Drops the oldest record, moving the time of the oldest on to the next one's
+  @param
+  @return
+*/
+void BluetoothLink::captureDropOldest() {
+  unsigned int at = captureTail;
+  byte length = (captureGet(&at) & 0x3F) + 1;
+  while (captureGet(&at) & 0x80) {
+  }
+  at = (at + length) % captureSize;
+  unsigned int dropped = (at + captureSize - captureTail) % captureSize;
+  if (dropped == 0) {
+    dropped = captureSize;
+  }
+  captureUsed -= dropped;
+  captureDropped += dropped;
+  captureTail = at;
+
+  if (captureUsed > 0) {
+    captureGet(&at);
+    uint32_t delta = 0;
+    byte shift = 0;
+    byte b;
+    do {
+      b = captureGet(&at);
+      delta |= (uint32_t)(b & 0x7F) << shift;
+      shift += 7;
+    } while (b & 0x80);
+    captureTailMicros += delta;
+  }
+}
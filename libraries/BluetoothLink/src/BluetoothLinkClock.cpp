@@ -0,0 +1,178 @@
+/*
+  BluetoothLink
+  Clock offset and drift from heartbeats, and the age of timestamped packets, see BluetoothLink.h.
+
+  micros() is taken as 32 bits, as it is on the boards, so the offsets wrap the same way on any host.
+*/
+
+#include "BluetoothLink.h"
+
+
+/************************************************************************************************************************/
+/************************/
+/*     Clock Sync       */
+/************************/
+/************************************************************************************************************************/
+
+/*
+  @desc Whether a heartbeat has been answered with timestamps, so the other device's clock is known
+  @param
+  @return boolean
+*/
+boolean BluetoothLink::isClockSynced() {
+  return clockSamples > 0;
+}
+
+/*
+  @desc Returns the other device's micros() minus ours, now
+  @param
+  @return long - us, 0 if the clocks are not synchronised yet
+*/
+long BluetoothLink::getClockOffset() {
+  if (clockSamples == 0) {
+    return 0;
+  }
+  return (int32_t)clockOffsetAt((uint32_t)micros());
+}
+
+/*
+  @desc Returns how fast the other device's clock runs against ours
+  @param
+  @return float - ppm, 0 until measured over clockDriftBaseline
+*/
+float BluetoothLink::getClockDrift() {
+  return clockDrift;
+}
+
+/*
+  @desc Converts a time from the other device's micros() to ours
+  @param uint32_t peerMicros
+  @return uint32_t - our micros() at that time, unchanged if the clocks are not synchronised yet
+*/
+uint32_t BluetoothLink::toLocalMicros(uint32_t peerMicros) {
+  if (clockSamples == 0) {
+    return peerMicros;
+  }
+  return peerMicros - clockOffsetAt((uint32_t)micros());
+}
+
+/*
+  @desc Returns how long ago the other device called send() for the last packet received, or
+  sent it again if it was
+  @param
+  @return long - us, noLatency if it had no timestamp or the clocks are not synchronised yet
+*/
+long BluetoothLink::getDataLatency() {
+  return rxLatency;
+}
+
+/*
+  @desc Whether the last packet of the given priority to leave the queue was answered with <NAK>,
+  older than the other device's maxDataAge when it arrived. lastSendDelivered() is false for it.
+  @param byte priority
+  @return boolean
+*/
+boolean BluetoothLink::lastSendStale(byte priority) {
+  if (priority > PRIORITY_URGENT) {
+    priority = PRIORITY_URGENT;
+  }
+  return txStale[priority];
+}
+
+/*
+  @desc Adds the offset measured by an answered heartbeat, and measures the drift once the best
+  sample is clockDriftBaseline on from the last one it was measured from
+  @param uint32_t t1 - our micros() when the heartbeat was sent
+  @param uint32_t t2 - the other device's micros() when it arrived
+  @param uint32_t t3 - the other device's micros() when it was answered
+  @param uint32_t t4 - our micros() when the answer arrived
+  @return
+*/
+void BluetoothLink::addClockSample(uint32_t t1, uint32_t t2, uint32_t t3, uint32_t t4) {
+  long delay = (int32_t)(t4 - t1) - (int32_t)(t3 - t2);
+  if (delay < 0) {
+    delay = 0;
+  }
+
+  // ((t2 - t1) + (t3 - t4)) / 2, without overflowing when the clocks are far apart
+  ClockSample *sample = clockFilter + clockNext;
+  sample->offset = (t2 - t1) - (uint32_t)(delay / 2);
+  sample->delay = delay;
+  sample->time = t4;
+  clockNext = (clockNext + 1) % clockFilterLength;
+  if (clockSamples < clockFilterLength) {
+    clockSamples++;
+  }
+
+  ClockSample *best = clockFilter + bestClockSample();
+  long elapsed = (int32_t)(best->time - driftAnchorTime);
+  if (clockSamples == 1) {
+    driftAnchorOffset = best->offset;
+    driftAnchorTime = best->time;
+  } else if (elapsed >= (long)clockDriftBaseline * 1000) {
+    float drift = (float)(int32_t)(best->offset - driftAnchorOffset) * 1000000.0 / elapsed;
+    if (clockDriftKnown) {
+      clockDrift += (drift - clockDrift) / 4;
+    } else {
+      clockDrift = drift;
+      clockDriftKnown = true;
+    }
+    driftAnchorOffset = best->offset;
+    driftAnchorTime = best->time;
+  }
+}
+
+/*
+  @desc Returns the sample with the shortest round trip, the one least affected by queueing
+  @param
+  @return int - index in clockFilter
+*/
+int BluetoothLink::bestClockSample() {
+  int best = 0;
+  for (int i = 1; i < clockSamples; i++) {
+    if (clockFilter[i].delay < clockFilter[best].delay) {
+      best = i;
+    }
+  }
+  return best;
+}
+
+/*
+  @desc Returns the offset of the best sample, moved on to the given time by the drift
+  @param uint32_t now - our micros()
+  @return uint32_t offset
+*/
+uint32_t BluetoothLink::clockOffsetAt(uint32_t now) {
+  ClockSample *best = clockFilter + bestClockSample();
+  long elapsed = (int32_t)(now - best->time);
+  return best->offset + (uint32_t)(int32_t)(clockDrift * elapsed / 1000000.0);
+}
+
+/*
+  @desc Reads up to 8 hex digits
+  @param const char *field
+  @param uint32_t *value
+  @return int - number of digits read, 0 if there is no valid number
+*/
+int BluetoothLink::readHex(const char *field, uint32_t *value) {
+  uint32_t number = 0;
+  int digits = 0;
+  for (const char *c = field; ; c++) {
+    int digit;
+    if (*c >= '0' && *c <= '9') {
+      digit = *c - '0';
+    } else if (*c >= 'a' && *c <= 'f') {
+      digit = *c - 'a' + 10;
+    } else if (*c >= 'A' && *c <= 'F') {
+      digit = *c - 'A' + 10;
+    } else {
+      break;
+    }
+    if (++digits > 8) {
+      return 0;
+    }
+    number = (number << 4) | digit;
+  }
+  *value = number;
+  return digits;
+}
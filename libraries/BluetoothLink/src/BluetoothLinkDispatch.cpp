@@ -0,0 +1,113 @@
+/*
+  BluetoothLink
+  Packets passed to a table of message handlers as they are read, see BluetoothLink.h.
+
+  The first line of the packet is the message type, the decimal index of its handler, e.g.
+    <&checksum*%sequence!#0$#12$#7$#3$@>
+  The lines are ended in place in rxBuffer, so a handler reads them as C strings without a String
+  being built. A type outside the table, a first line that is not a number, or more than
+  maxMessageLines lines goes to the fallback handler. The line pointers are kept in a fixed array
+  rather than allocated per packet, so a longer packet reaches the fallback with only its first
+  maxMessageLines lines, marked truncated and counted in stats.truncatedMessages.
+
+  The table is the sketch's const array, fixed at compile time, indexed by the type. The library
+  is compiled apart from the sketch, so the link keeps a pointer to it given once by setHandlers().
+*/
+
+#include "BluetoothLink.h"
+
+
+/************************************************************************************************************************/
+/************************/
+/*     Dispatch         */
+/************************/
+/************************************************************************************************************************/
+
+/*
+  @desc Passes every packet received from now on to the handler for its message type, in place
+  of storing it for getData(). receivedNewData() still returns true once for each.
+  @param const BluetoothHandler handlers[] - indexed by message type, entries may be NULL
+  @param int count - entries in handlers, NULL and 0 to store packets for getData() again
+  @param BluetoothHandler fallback - for types without a handler, may be NULL
+  @return
+*/
+void BluetoothLink::setHandlers(const BluetoothHandler handlers[], int count, BluetoothHandler fallback) {
+  this->handlers = count > 0 ? handlers : NULL;
+  handlerCount = count > 0 ? count : 0;
+  fallbackHandler = fallback;
+  clearMemory();
+}
+
+/*
+  @desc Splits the data into its lines, without their markers, and calls the handler for its type
+  @param char *data - data without checksum
+  @param int len - length of data
+  @param byte priority - of the packet
+  @return
+*/
+void BluetoothLink::dispatchMessage(char *data, int len, byte priority) {
+  // end each line in place, counting only lines that have both markers as rebuildData() does
+  int lineCount = 0;
+  boolean tooLong = false;
+  int lineStart = -1;
+  for (int i = 0; i < len; i++) {
+    if (lineStart < 0 && *(data + i) == lineStartMarker) {
+      lineStart = i + 1;
+    } else if (lineStart >= 0 && *(data + i) == lineEndMarker) {
+      if (lineCount == maxMessageLines) {
+        tooLong = true;
+        break;
+      }
+      *(data + i) = '\0';
+      messageLines[lineCount++] = data + lineStart;
+      lineStart = -1;
+    }
+  }
+
+  BluetoothMessage message;
+  message.type = lineCount > 0 ? readMessageType(messageLines[0]) : noMessageType;
+  message.lines = messageLines;
+  message.lineCount = lineCount;
+  message.truncated = tooLong;
+  message.priority = priority;
+  message.latency = rxLatency;
+
+  if (tooLong) {
+    stats.truncatedMessages++;
+    if (includeErrorMessage) {
+      debugPort->println(F("Message cut short, too many lines"));
+    }
+  }
+
+  BluetoothHandler handler = NULL;
+  if (!tooLong && message.type >= 0 && message.type < handlerCount) {
+    handler = *(handlers + message.type);
+  }
+  if (handler == NULL) {
+    stats.unhandledMessages++;
+    handler = fallbackHandler;
+    if (includeErrorMessage) {
+      debugPort->println(F("No handler for message"));
+    }
+  }
+  if (handler != NULL) {
+    handler(message);
+  }
+}
+
+/*
+  @desc Reads the message type from the first line of a packet
+  @param const char *line - ended with '\0'
+  @return int - the type, noMessageType if the line is not a number up to maxMessageType
+*/
+int BluetoothLink::readMessageType(const char *line) {
+  int type = 0;
+  int digits = 0;
+  for (; *line != '\0'; line++) {
+    if (*line < '0' || *line > '9' || ++digits > 3) {
+      return noMessageType;
+    }
+    type = type * 10 + (*line - '0');
+  }
+  return digits > 0 && type <= maxMessageType ? type : noMessageType;
+}
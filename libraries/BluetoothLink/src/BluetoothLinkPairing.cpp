@@ -0,0 +1,228 @@
+/*
+  BluetoothLink
+  Module settings and the peer kept in EEPROM between boots, see BluetoothLink.h.
+
+  The cache at the address given to setPairingCache() is
+    'B', 'L', pairingVersion, sizeof(BluetoothLinkPairing), the BluetoothLinkPairing, CRC8 of it
+  and is written with EEPROM.update(), so only the bytes that changed wear the EEPROM. The HM-10
+  keeps its role and name itself: the cache only saves asking for them, and a module changed by
+  something else since is not noticed, clearPairing() makes the next boot set it up in full.
+*/
+
+#include "BluetoothLink.h"
+#include <EEPROM.h>
+
+
+/************************************************************************************************************************/
+/************************/
+/*    Pairing Cache     */
+/************************/
+/************************************************************************************************************************/
+
+/*
+  @desc Keeps the pairing in EEPROM at the given address and reads what was kept there, if any.
+  Call before setupModule(). The cached peer is connected to if no peer MAC has been set.
+  @param int eepromAddress
+  @param unsigned long baud - of the port, a cache read at another rate is not used
+  @return
+*/
+void BluetoothLink::setPairingCache(int eepromAddress, unsigned long baud) {
+  pairingAddress = eepromAddress;
+  pairingValid = loadPairing() && pairing.baud == baud;
+  if (!pairingValid) {
+    memset(&pairing, 0, sizeof(pairing));
+    pairing.baud = baud;
+  }
+  if (pairingValid && peerMAC.length() == 0) {
+    peerMAC = pairing.peerMAC;
+  }
+  if (testingMessages) {
+    debugPort->println(pairingValid ? F("Pairing cache read") : F("No pairing cache"));
+  }
+}
+
+/*
+  @desc Sets the module's role and name, skipping what it already has, and as a central starts
+  connecting to the peer MAC without waiting. Asks for the module's address only: if it is the
+  module in the pairing cache, its role and name are taken from there. A central without a peer
+  MAC, set or cached, takes the module it last connected to from AT+RADD?; if it has never
+  connected there is nothing to connect to, see getPeerMAC().
+  @param int role - 0=slave, 1=master
+  @param String name - empty to leave it as it is, cut to maxNameLength as the module would
+  @return boolean - true if the module has the settings
+*/
+boolean BluetoothLink::setupModule(int role, const String &fullName) {
+  String name = fullName.substring(0, maxNameLength);
+  if (!canDoAT()) {
+    // already connected, so it was set up on an earlier boot
+    return true;
+  }
+
+  String response = atQuery("AT+ADDR?");
+  int found = response.indexOf("OK+ADDR:");
+  String address = found < 0 ? "" : response.substring(found + 8, found + 8 + macLength);
+  boolean sameModule = pairingValid && address.length() == macLength && address == pairing.address;
+  if (testingMessages) {
+    debugPort->println(sameModule ? F("Module as cached") : F("Module not cached, setting it up"));
+  }
+
+  // the module remembers the last one it connected to, even if it was never cached here
+  if (role == 1 && peerMAC.length() == 0) {
+    response = atQuery("AT+RADD?");
+    found = response.indexOf("OK+RADD:");
+    String lastPeer = found < 0 ? "" : response.substring(found + 8, found + 8 + macLength);
+    if (lastPeer.length() == macLength && lastPeer != "000000000000") {
+      peerMAC = lastPeer;
+    }
+  }
+
+  boolean ok = true;
+  if (!sameModule || pairing.role != role) {
+    ok = changeRole(role) && ok;
+  }
+  if (name.length() > 0 && (!sameModule || name != pairing.name)) {
+    ok = changeName(name) && ok;
+  }
+
+  if (ok && address.length() == macLength) {
+    if (!sameModule) {
+      memset(pairing.name, 0, sizeof(pairing.name));
+    }
+    strncpy(pairing.address, address.c_str(), macLength);
+    if (name.length() > 0) {
+      strncpy(pairing.name, name.c_str(), maxNameLength);
+    }
+    pairing.role = role;
+    if (peerMAC.length() == macLength) {
+      strncpy(pairing.peerMAC, peerMAC.c_str(), macLength);
+    }
+    savePairing();
+  }
+
+  if (role == 1 && peerMAC.length() == 0) {
+    if (includeErrorMessage) {
+      debugPort->println(F("No peer MAC, and the module has never connected to one"));
+    }
+  } else if (role == 1) {
+    unsigned long now = millis();
+    linkState = LINK_LOST;
+    linkLostTime = now;
+    // it answered AT commands, so it is not connected
+    moduleDisconnected = true;
+    startConnect(now);
+  }
+  return ok;
+}
+
+/*
+  @desc Whether the pairing cache held settings for this baud rate, or has been written since
+  @param
+  @return boolean
+*/
+boolean BluetoothLink::hasPairing() {
+  return pairingValid;
+}
+
+/*
+  @desc Returns the cached settings
+  @param
+  @return BluetoothLinkPairing
+*/
+const BluetoothLinkPairing &BluetoothLink::getPairing() {
+  return pairing;
+}
+
+/*
+  @desc Forgets the cached settings, so the next setupModule() sets the module up in full
+  @param
+  @return
+*/
+void BluetoothLink::clearPairing() {
+  uint32_t baud = pairing.baud;
+  memset(&pairing, 0, sizeof(pairing));
+  pairing.baud = baud;
+  pairingValid = false;
+  if (pairingAddress != noPairingCache) {
+    EEPROM.update(pairingAddress, 0xFF);
+  }
+}
+
+/*
+  @desc Reads the pairing cache from EEPROM
+  @param
+  @return boolean - false if there is none, it is from another version, or fails its CRC
+*/
+boolean BluetoothLink::loadPairing() {
+  if (pairingAddress == noPairingCache || pairingAddress + 5 + sizeof(pairing) > EEPROM.length()) {
+    return false;
+  }
+  if (EEPROM.read(pairingAddress) != 'B' || EEPROM.read(pairingAddress + 1) != 'L' ||
+      EEPROM.read(pairingAddress + 2) != pairingVersion || EEPROM.read(pairingAddress + 3) != sizeof(pairing)) {
+    return false;
+  }
+  byte *bytes = (byte *)&pairing;
+  for (size_t i = 0; i < sizeof(pairing); i++) {
+    *(bytes + i) = EEPROM.read(pairingAddress + 4 + i);
+  }
+  if (CRC8(bytes, sizeof(pairing)) != EEPROM.read(pairingAddress + 4 + sizeof(pairing))) {
+    return false;
+  }
+  // never trust the terminators
+  pairing.address[macLength] = '\0';
+  pairing.peerMAC[macLength] = '\0';
+  pairing.name[maxNameLength] = '\0';
+  return true;
+}
+
+/*
+  @desc Writes the pairing cache to EEPROM, with the peer MAC, the bytes that have not changed are not written
+  @param
+  @return
+*/
+void BluetoothLink::savePairing() {
+  if (pairingAddress == noPairingCache || pairingAddress + 5 + sizeof(pairing) > EEPROM.length()) {
+    return;
+  }
+  if (peerMAC.length() == macLength) {
+    strncpy(pairing.peerMAC, peerMAC.c_str(), macLength);
+  }
+  const byte *bytes = (const byte *)&pairing;
+  EEPROM.update(pairingAddress, 'B');
+  EEPROM.update(pairingAddress + 1, 'L');
+  EEPROM.update(pairingAddress + 2, pairingVersion);
+  EEPROM.update(pairingAddress + 3, sizeof(pairing));
+  for (size_t i = 0; i < sizeof(pairing); i++) {
+    EEPROM.update(pairingAddress + 4 + i, *(bytes + i));
+  }
+  EEPROM.update(pairingAddress + 4 + sizeof(pairing), CRC8(bytes, sizeof(pairing)));
+  pairingValid = true;
+}
+
+/*
+  @desc Sends an AT command and reads the answer, complete once nothing more has come for
+  atReplyGap. Unlike atResponse() it does not check the STATE pin or wait a fixed time.
+  @param String command
+  @return String - the answer, empty if there was none within atTimeout
+*/
+String BluetoothLink::atQuery(const String &command) {
+  transmit(command);
+
+  String response = "";
+  unsigned long start = millis();
+  unsigned long lastByte = start;
+  while (true) {
+    unsigned long now = millis();
+    if (port->available()) {
+      response.concat((char)port->read());
+      lastByte = now;
+    } else if (response.length() > 0 ? now - lastByte >= atReplyGap : now - start >= atTimeout) {
+      break;
+    }
+  }
+  captureBytes(CAPTURE_RX, (const uint8_t *)response.c_str(), response.length());
+  if (includeErrorMessage) {
+    debugPort->println();
+    debugPort->println(response);
+  }
+  return response;
+}
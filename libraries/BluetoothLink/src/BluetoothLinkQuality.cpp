@@ -0,0 +1,334 @@
+/*
+  BluetoothLink
+  Heartbeats, link quality estimates and reconnecting in the background, see BluetoothLink.h.
+*/
+
+#include "BluetoothLink.h"
+
+
+/************************************************************************************************************************/
+/************************/
+/*    Link Status       */
+/************************/
+/************************************************************************************************************************/
+
+/*
+  @desc Whether the other device has been heard from within linkTimeout and the module has not
+  reported the connection lost. Unlike getConnectionStatus() this does not wait.
+  @param
+  @return boolean
+*/
+boolean BluetoothLink::isLinkUp() {
+  return linkState == LINK_UP;
+}
+
+/*
+  @desc Returns the round trip and loss estimates, and how long reconnecting has taken
+  @param
+  @return BluetoothLinkQuality
+*/
+const BluetoothLinkQuality &BluetoothLink::getLinkQuality() {
+  return quality;
+}
+
+/*
+  @desc Notes that something valid was received from the other device
+  @param unsigned long now - millis()
+  @return
+*/
+void BluetoothLink::heard(unsigned long now) {
+  lastHeardTime = now;
+  if (linkState != LINK_UP) {
+    linkRestored(now);
+  }
+}
+
+/*
+  @desc Times out the heartbeat and the link, and moves reconnecting along. Never waits for the module.
+  AT+CON is only sent once the module is known to have dropped the connection.
+  @param unsigned long now - millis()
+  @return
+*/
+void BluetoothLink::checkLink(unsigned long now) {
+  if (heartbeatWaiting && now - heartbeatSentTime >= heartbeatInterval) {
+    finishHeartbeat(false);
+  }
+
+  // OK+CONN with nothing after it
+  if (atConnPending && now - atLastByteTime >= atNotificationGap) {
+    linkRestored(now);
+  }
+
+  switch (linkState) {
+    case LINK_UP:
+      if (now - lastHeardTime >= linkTimeout) {
+        if (includeErrorMessage) {
+          debugPort->println(F("Nothing heard from the other device"));
+        }
+        linkLost(now);
+      }
+      break;
+
+    case LINK_LOST:
+      // STATE is HIGH while connected and blinks while not, so one low reading is enough
+      if (!moduleDisconnected && digitalRead(statusPin) == LOW) {
+        moduleDisconnected = true;
+      }
+      if (autoReconnect && moduleDisconnected && peerMAC.length() > 0 &&
+          now - reconnectTime >= reconnectRetryDelay && now - lastWriteTime >= atCommandGap) {
+        startConnect(now);
+      }
+      break;
+
+    case LINK_CONNECTING:
+      if (now - reconnectTime >= reconnectTimeout) {
+        if (includeErrorMessage) {
+          debugPort->println(F("No answer to AT+CON"));
+        }
+        linkState = LINK_LOST;
+        reconnectTime = now;
+      }
+      break;
+  }
+}
+
+/*
+  @desc Stops sending data until the link is back. The packet being written is sent again from the start.
+  @param unsigned long now - millis()
+  @return
+*/
+void BluetoothLink::linkLost(unsigned long now) {
+  if (linkState != LINK_UP) {
+    return;
+  }
+  if (includeErrorMessage) {
+    debugPort->println(F("Bluetooth link lost"));
+  }
+  linkState = LINK_LOST;
+  linkLostTime = now;
+  // the first AT+CON goes as soon as the module will read it
+  reconnectTime = now - reconnectRetryDelay;
+  quality.disconnects++;
+
+  if (txCurrent == transferSlot) {
+    transferFrameCut();
+  }
+  txCurrent = -1;
+  txOffset = 0;
+
+  // packets whose acknowledgement can no longer come are sent again once the link is back,
+  // without counting against their attempts
+  for (int i = 0; i < sendQueueLength; i++) {
+    OutgoingPacket *out = txQueue + i;
+    if (out->state == SLOT_WAITING_ACK) {
+      out->state = SLOT_QUEUED;
+      out->attempts--;
+    }
+  }
+}
+
+/*
+  @desc Sends AT+CON to the peer MAC, the answer is read by update() without waiting for it
+  @param unsigned long now - millis()
+  @return
+*/
+void BluetoothLink::startConnect(unsigned long now) {
+  if (testingMessages) {
+    debugPort->print(F("\nReconnecting: AT+CON"));
+    debugPort->println(peerMAC);
+  }
+  atLength = 0;
+  transmit("AT+CON" + peerMAC);
+  linkState = LINK_CONNECTING;
+  reconnectTime = now;
+  quality.reconnectAttempts++;
+}
+
+/*
+  @desc Carries on sending once the other device is heard from again, a stalled transfer included
+  @param unsigned long now - millis()
+  @return
+*/
+void BluetoothLink::linkRestored(unsigned long now) {
+  atConnPending = false;
+  if (linkState == LINK_UP) {
+    return;
+  }
+  if (includeErrorMessage) {
+    debugPort->println(F("Bluetooth link restored"));
+  }
+  linkState = LINK_UP;
+  lastHeardTime = now;
+  moduleDisconnected = false;
+
+  // the peer is known to be right once connected to
+  if (pairingValid && pairing.role == 1 && peerMAC != pairing.peerMAC && peerMAC.length() == macLength) {
+    savePairing();
+  }
+
+  quality.lastReconnectTime = now - linkLostTime;
+  if (quality.lastReconnectTime > quality.worstReconnectTime) {
+    quality.worstReconnectTime = quality.lastReconnectTime;
+  }
+
+  // frames sent while the link was down are lost
+  if (transferWindow != NULL) {
+    transferIsStalled = false;
+    transferTimeouts = 0;
+    transferSent = transferAcked;
+    transferTimer = now;
+  }
+}
+
+/*
+  @desc Reads a byte received outside a packet, looking for the module's OK+CONN, OK+CONNF,
+  OK+CONNE and OK+LOST notifications
+  @param char c
+  @param unsigned long now - millis()
+  @return
+*/
+void BluetoothLink::readModuleByte(char c, unsigned long now) {
+  // OK+CONN followed by A is only OK+CONNA, the connection is not made yet
+  if (atConnPending) {
+    atConnPending = false;
+    if (c != 'A' && c != 'F' && c != 'E') {
+      linkRestored(now);
+    }
+  }
+
+  if (atLength == atBufferLength) {
+    memmove(atBuffer, atBuffer + 1, atBufferLength - 1);
+    atLength--;
+  }
+  atBuffer[atLength++] = c;
+  atBuffer[atLength] = '\0';
+  atLastByteTime = now;
+
+  if (atBufferEndsWith("OK+LOST")) {
+    linkLost(now);
+    moduleDisconnected = true;
+  } else if (atBufferEndsWith("OK+CONNF") || atBufferEndsWith("OK+CONNE")) {
+    if (linkState == LINK_CONNECTING) {
+      linkState = LINK_LOST;
+      reconnectTime = now;
+    }
+  } else if (atBufferEndsWith("OK+CONN")) {
+    atConnPending = true;
+  }
+}
+
+/*
+  @desc Checks whether the last bytes received outside packets are the given notification
+  @param const char *notification
+  @return boolean
+*/
+boolean BluetoothLink::atBufferEndsWith(const char *notification) {
+  int len = strlen(notification);
+  return atLength >= len && strncmp(atBuffer + atLength - len, notification, len) == 0;
+}
+
+
+/************************************************************************************************************************/
+/************************/
+/*     Heartbeat        */
+/************************/
+/************************************************************************************************************************/
+
+/*
+  @desc Sends a heartbeat, answered by the other device straight away
+  @param unsigned long now - millis()
+  @return
+*/
+void BluetoothLink::sendHeartbeat(unsigned long now) {
+  heartbeatSequence++;
+  String ping = "<PING";
+  ping.concat(sequenceMarker);
+  ping.concat(String(heartbeatSequence));
+  ping.concat(packetEndMarker);
+
+  transmit(ping);
+  stats.bytesSent += ping.length();
+  heartbeatWaiting = true;
+  heartbeatSentTime = now;
+  heartbeatSentMicros = micros();
+  quality.heartbeatsSent++;
+}
+
+/*
+  @desc Answers the other device's heartbeat with the same sequence number, and the times the
+  heartbeat arrived and is answered for its clock estimate
+  @param
+  @return
+*/
+void BluetoothLink::sendHeartbeatReply() {
+  String pong = "<PONG";
+  if (pongSequence != noSequence) {
+    pong.concat(sequenceMarker);
+    pong.concat(String(pongSequence));
+  }
+  pong.concat(',');
+  pong.concat(String((unsigned long)pingReceivedMicros, HEX));
+  pong.concat(',');
+  pong.concat(String((unsigned long)(uint32_t)micros(), HEX));
+  pong.concat(packetEndMarker);
+
+  transmit(pong);
+  stats.bytesSent += pong.length();
+  pongDue = false;
+}
+
+/*
+  @desc Updates the round trip estimate from the answer to the last heartbeat, and the clock
+  estimate if the answer has the other device's timestamps
+  @param int sequence - of the heartbeat answered
+  @param const char *timestamps - ",t2,t3>" in the answer, NULL if there are none
+  @return
+*/
+void BluetoothLink::receivedHeartbeatReply(int sequence, const char *timestamps) {
+  if (!heartbeatWaiting || sequence != heartbeatSequence) {
+    return;
+  }
+  uint32_t received = (uint32_t)micros();
+  long sample = (int32_t)(received - (uint32_t)heartbeatSentMicros);
+
+  uint32_t t2, t3;
+  int digits;
+  if (timestamps != NULL && (digits = readHex(timestamps + 1, &t2)) > 0 &&
+      *(timestamps + 1 + digits) == ',' && readHex(timestamps + 2 + digits, &t3) > 0) {
+    // times of the start of each message, so the longer answer does not skew the offset
+    addClockSample((uint32_t)heartbeatSentMicros, t2, t3, rxStartMicros);
+  }
+
+  // smoothed as for TCP's retransmission timer, RFC 6298
+  if (quality.rtt == 0) {
+    quality.rtt = sample;
+    quality.rttVariation = sample / 2;
+  } else {
+    long error = sample - (long)quality.rtt;
+    quality.rtt = (long)quality.rtt + error / 8;
+    quality.rttVariation = (long)quality.rttVariation + ((error < 0 ? -error : error) - (long)quality.rttVariation) / 4;
+  }
+  finishHeartbeat(true);
+}
+
+/*
+  @desc Records whether the last heartbeat was answered, and the loss over the last 32
+  @param boolean answered
+  @return
+*/
+void BluetoothLink::finishHeartbeat(boolean answered) {
+  heartbeatWaiting = false;
+  heartbeatHistory = (heartbeatHistory << 1) | (answered ? 0 : 1);
+  if (heartbeatCount < 32) {
+    heartbeatCount++;
+  }
+  if (!answered) {
+    quality.heartbeatsLost++;
+  }
+
+  byte lost = 0;
+  for (byte i = 0; i < heartbeatCount; i++) {
+    lost += (heartbeatHistory >> i) & 1;
+  }
+  quality.lossPercent = (unsigned int)lost * 100 / heartbeatCount;
+}
@@ -0,0 +1,483 @@
+/*
+  BluetoothLink
+  Bulk transfers: a byte payload of any length streamed in frames, see BluetoothLink.h.
+*/
+
+#include "BluetoothLink.h"
+
+
+/************************************************************************************************************************/
+/************************/
+/*    Send Transfer     */
+/************************/
+/************************************************************************************************************************/
+
+/*
+  @desc Starts a transfer of the given number of bytes. The bytes are given with write() as they
+  become available, and sent by update() whenever no queued packet is waiting.
+  Holds transferWindowLength bytes and one frame in RAM until the transfer is finished.
+  @param unsigned long totalLength - bytes in the whole payload
+  @return boolean - false if a transfer is already in progress or there is nothing to send
+*/
+boolean BluetoothLink::beginTransfer(unsigned long totalLength) {
+  if (isTransferring()) {
+    if (includeErrorMessage) {
+      debugPort->println(F("Transfer already in progress"));
+    }
+    return false;
+  }
+  if (totalLength == 0) {
+    return false;
+  }
+
+  transferWindow = new byte[transferWindowLength];
+  transferFrame = new char[maxPacketLength];
+  // never the same as the last id, and unlikely to be the one before a reset
+  transferId += 1 + (micros() & 0x7F);
+  transferLength = totalLength;
+  transferWritten = 0;
+  transferSent = 0;
+  transferAcked = 0;
+  transferTimer = millis();
+  transferTimeouts = 0;
+  transferIsStalled = false;
+  transferOk = false;
+  return true;
+}
+
+/*
+  @desc Adds bytes to the transfer, as many as fit in the window. The rest must be given again
+  once the other device has acknowledged some of what was sent.
+  @param const byte *data
+  @param size_t len
+  @return size_t - number of bytes taken, 0 if the window is full or there is no transfer
+*/
+size_t BluetoothLink::write(const byte *data, size_t len) {
+  if (transferWindow == NULL) {
+    return 0;
+  }
+
+  unsigned long room = transferWindowLength - (transferWritten - transferAcked);
+  if (room > transferLength - transferWritten) {
+    room = transferLength - transferWritten;
+  }
+  if (len > room) {
+    len = room;
+  }
+
+  for (size_t i = 0; i < len; i++) {
+    *(transferWindow + (transferWritten + i) % transferWindowLength) = *(data + i);
+  }
+  transferWritten += len;
+  return len;
+}
+
+/*
+  @desc Marks the end of the bytes given to write(). The transfer carries on in update() until
+  the other device has acknowledged all of it, see isTransferring() and transferDelivered().
+  @param
+  @return boolean - false if fewer than totalLength bytes were written, the transfer is cancelled
+*/
+boolean BluetoothLink::endTransfer() {
+  if (transferWindow == NULL) {
+    // already acknowledged, or cancelled
+    return transferOk;
+  }
+  if (transferWritten < transferLength) {
+    if (includeErrorMessage) {
+      debugPort->println(F("Transfer ended before all bytes were written"));
+    }
+    finishTransfer(false);
+    return false;
+  }
+  return true;
+}
+
+/*
+  @desc Gives up on the transfer, e.g. one that has stalled and cannot be resumed
+  @param
+  @return
+*/
+void BluetoothLink::cancelTransfer() {
+  if (transferWindow != NULL) {
+    finishTransfer(false);
+  }
+}
+
+/*
+  @desc Whether a transfer has been started and not yet acknowledged or cancelled
+  @param
+  @return boolean
+*/
+boolean BluetoothLink::isTransferring() {
+  return transferWindow != NULL;
+}
+
+/*
+  @desc Whether the transfer has stopped after transferAttempts acknowledgement timeouts in a row,
+  e.g. because the link was lost. Nothing is sent until resumeTransfer() is called.
+  @param
+  @return boolean
+*/
+boolean BluetoothLink::transferStalled() {
+  return transferWindow != NULL && transferIsStalled;
+}
+
+/*
+  @desc Carries on a stalled transfer from the last offset acknowledged by the other device
+  @param
+  @return
+*/
+void BluetoothLink::resumeTransfer() {
+  if (transferWindow == NULL) {
+    return;
+  }
+  transferIsStalled = false;
+  transferTimeouts = 0;
+  transferSent = transferAcked;
+  transferTimer = millis();
+}
+
+/*
+  @desc Whether the last transfer was acknowledged in full by the other device
+  @param
+  @return boolean
+*/
+boolean BluetoothLink::transferDelivered() {
+  return transferOk;
+}
+
+/*
+  @desc Returns the number of bytes of the transfer the other device has acknowledged,
+  where a resumed transfer carries on from
+  @param
+  @return unsigned long
+*/
+unsigned long BluetoothLink::getTransferAcked() {
+  return transferAcked;
+}
+
+/*
+  @desc Builds the next frame of the transfer from the window, if there are bytes not yet sent
+  @param
+  @return boolean - true if a frame is ready to be written
+*/
+boolean BluetoothLink::nextTransferFrame() {
+  if (transferWindow == NULL || transferIsStalled) {
+    return false;
+  }
+  // bytes before the acknowledged offset may already be overwritten
+  if (transferSent < transferAcked) {
+    transferSent = transferAcked;
+  }
+  if (transferSent >= transferWritten) {
+    return false;
+  }
+
+  // the checksum covers the rest of the frame, so the frame is built after room for it
+  int checksumRoom = 6;   // <&255*
+  char *body = transferFrame + checksumRoom;
+  int bodyLength = 0;
+
+  String header = String(transferMarker) + String(transferId) + "," + String(transferSent);
+  if (transferSent == 0) {
+    header.concat("," + String(transferLength));
+  }
+  header.concat(dataStartMarker);
+  memcpy(body, header.c_str(), header.length());
+  bodyLength = header.length();
+
+  unsigned long offset = transferSent;
+  int payloadLength = 0;
+  while (offset < transferWritten && payloadLength + 2 <= transferFrameLength) {
+    byte b = *(transferWindow + offset % transferWindowLength);
+    if (b == packetStartMarker || b == packetEndMarker || b == transferEscape) {
+      *(body + bodyLength++) = transferEscape;
+      *(body + bodyLength++) = b ^ 0x20;
+      payloadLength += 2;
+    } else {
+      *(body + bodyLength++) = b;
+      payloadLength++;
+    }
+    offset++;
+  }
+  *(body + bodyLength++) = dataEndMarker;
+
+  String prefix = String(packetStartMarker) + String(checksumStartMarker) +
+                  String(CRC8((const byte *)body, bodyLength)) + String(checksumEndMarker);
+  memmove(transferFrame + prefix.length(), body, bodyLength);
+  memcpy(transferFrame, prefix.c_str(), prefix.length());
+  transferFrameSize = prefix.length() + bodyLength;
+  *(transferFrame + transferFrameSize++) = packetEndMarker;
+
+  transferFrameOffset = transferSent;
+  transferSent = offset;
+  return true;
+}
+
+/*
+  @desc Starts the acknowledgement timer once a frame has been written
+  @param unsigned long now - millis()
+  @return
+*/
+void BluetoothLink::transferFrameSent(unsigned long now) {
+  transferTimer = now;
+}
+
+/*
+  @desc Sends the frame that was cut short for an urgent packet again from its start
+  @param
+  @return
+*/
+void BluetoothLink::transferFrameCut() {
+  transferSent = transferFrameOffset;
+}
+
+/*
+  @desc Goes back to the last acknowledged offset when nothing has been acknowledged for ackTimeout,
+  stalling the transfer after transferAttempts timeouts in a row
+  @param unsigned long now - millis()
+  @return
+*/
+void BluetoothLink::checkTransferTimeout(unsigned long now) {
+  // frames are not sent while the link is down, linkRestored() sends them again
+  if (transferWindow == NULL || transferIsStalled || transferAcked >= transferSent ||
+      txCurrent == transferSlot || linkState != LINK_UP || now - transferTimer < ackTimeout) {
+    return;
+  }
+
+  stats.retransmits++;
+  transferTimeouts++;
+  transferSent = transferAcked;
+  transferTimer = now;
+  if (transferTimeouts >= transferAttempts) {
+    transferIsStalled = true;
+    if (includeErrorMessage) {
+      debugPort->print(F("Transfer stalled at "));
+      debugPort->println(transferAcked);
+    }
+  }
+}
+
+/*
+  @desc Frees the window once the transfer is acknowledged in full or cancelled
+  @param boolean delivered
+  @return
+*/
+void BluetoothLink::finishTransfer(boolean delivered) {
+  if (txCurrent == transferSlot) {
+    txCurrent = -1;
+    txOffset = 0;
+  }
+  if (!delivered) {
+    stats.sendFailures++;
+  }
+  delete[] transferWindow;
+  delete[] transferFrame;
+  transferWindow = NULL;
+  transferFrame = NULL;
+  transferOk = delivered;
+}
+
+/*
+  @desc Moves the window on to the offset the other device has acknowledged, <ACK~id,offset>
+  @param const char *field - first character after <ACK~
+  @param unsigned long now - millis()
+  @return
+*/
+void BluetoothLink::receivedTransferAcknowledge(const char *field, unsigned long now) {
+  unsigned long id;
+  unsigned long offset;
+  field = readNumber(field, &id);
+  if (field == NULL || *field != ',') {
+    return;
+  }
+  field = readNumber(field + 1, &offset);
+  if (field == NULL || *field != packetEndMarker) {
+    return;
+  }
+
+  if (transferWindow == NULL || id != transferId || offset <= transferAcked || offset > transferWritten) {
+    return;
+  }
+  stats.transferBytesSent += offset - transferAcked;
+  transferAcked = offset;
+  transferTimeouts = 0;
+  transferTimer = now;
+
+  if (transferAcked >= transferLength) {
+    finishTransfer(true);
+  }
+}
+
+
+/************************************************************************************************************************/
+/************************/
+/*   Receive Transfer   */
+/************************/
+/************************************************************************************************************************/
+
+/*
+  @desc Checks if update() received the next chunk of a transfer, and acknowledges it.
+  Must be checked after every update(): a chunk not taken is dropped and sent again by the other device.
+  @param
+  @return boolean - true once for each chunk, in order
+*/
+boolean BluetoothLink::receivedTransferData() {
+  if (!rxChunkReady) {
+    return false;
+  }
+  rxChunkReady = false;
+  rxTransferTaken += rxChunkSize;
+  stats.transferBytesReceived += rxChunkSize;
+  transferAckDue = true;
+  return true;
+}
+
+/*
+  @desc Returns the bytes of the last chunk received. Only valid until the next update().
+  @param
+  @return const byte *pointer
+*/
+const byte *BluetoothLink::getTransferData() {
+  return rxChunk;
+}
+
+/*
+  @desc Returns the number of bytes in the last chunk received
+  @param
+  @return int
+*/
+int BluetoothLink::getTransferDataSize() {
+  return rxChunkSize;
+}
+
+/*
+  @desc Returns the position in the whole payload of the chunk taken by receivedTransferData()
+  @param
+  @return unsigned long
+*/
+unsigned long BluetoothLink::getTransferOffset() {
+  return rxTransferTaken - rxChunkSize;
+}
+
+/*
+  @desc Returns the length of the whole payload being received
+  @param
+  @return unsigned long
+*/
+unsigned long BluetoothLink::getTransferLength() {
+  return rxTransferLength;
+}
+
+/*
+  @desc Handles a transfer frame that passed the checksum. The next chunk in order is unescaped in
+  place and held for receivedTransferData(); a frame already taken is acknowledged again.
+  @param char *data - frame from the transfer marker to the data end marker
+  @param int len - length of data
+  @return
+*/
+void BluetoothLink::processTransferFrame(char *data, int len) {
+  unsigned long id;
+  unsigned long offset;
+  unsigned long total = 0;
+  boolean hasTotal = false;
+
+  const char *field = readNumber(data + 1, &id);
+  if (field == NULL || *field != ',' || id > 255) {
+    stats.droppedPackets++;
+    return;
+  }
+  field = readNumber(field + 1, &offset);
+  if (field != NULL && *field == ',') {
+    field = readNumber(field + 1, &total);
+    hasTotal = true;
+  }
+  if (field == NULL || *field != dataStartMarker || *(data + len - 1) != dataEndMarker ||
+      field >= data + len - 1) {
+    stats.droppedPackets++;
+    return;
+  }
+  char *payload = data + (field - data) + 1;
+  int payloadLength = data + len - 1 - payload;
+
+  if ((int)id != rxTransferId) {
+    if (!hasTotal || offset != 0) {
+      // started before this device was listening
+      stats.droppedPackets++;
+      return;
+    }
+    rxTransferId = id;
+    rxTransferLength = total;
+    rxTransferTaken = 0;
+  }
+
+  if (offset < rxTransferTaken) {
+    stats.duplicatePackets++;
+    transferAckDue = true;
+    return;
+  }
+  if (offset > rxTransferTaken || payloadLength <= 0) {
+    // a frame before it was lost, wait for the other device to go back
+    stats.droppedPackets++;
+    return;
+  }
+
+  int size = 0;
+  for (int i = 0; i < payloadLength; i++) {
+    char c = *(payload + i);
+    if (c == transferEscape) {
+      if (++i >= payloadLength) {
+        stats.droppedPackets++;
+        return;
+      }
+      c = *(payload + i) ^ 0x20;
+    }
+    *(payload + size++) = c;
+  }
+  if (offset + size > rxTransferLength) {
+    stats.droppedPackets++;
+    return;
+  }
+
+  rxChunk = (const byte *)payload;
+  rxChunkSize = size;
+  rxChunkReady = true;
+}
+
+/*
+  @desc Tells the other device how many bytes of the transfer have been taken
+  @param
+  @return
+*/
+void BluetoothLink::sendTransferAcknowledge() {
+  String ack = "<ACK";
+  ack.concat(transferMarker);
+  ack.concat(String(rxTransferId));
+  ack.concat(',');
+  ack.concat(String(rxTransferTaken));
+  ack.concat(packetEndMarker);
+
+  transmit(ack);
+  stats.bytesSent += ack.length();
+  transferAckDue = false;
+}
+
+/*
+  @desc Reads a decimal number of up to 10 digits
+  @param const char *field - first digit
+  @param unsigned long *value - set to the number read
+  @return const char * - first character after the number, NULL if there is no valid number
+*/
+const char *BluetoothLink::readNumber(const char *field, unsigned long *value) {
+  *value = 0;
+  int digits = 0;
+  while (*field >= '0' && *field <= '9') {
+    if (++digits > 9) {
+      return NULL;
+    }
+    *value = *value * 10 + (*field - '0');
+    field++;
+  }
+  return digits > 0 ? field : NULL;
+}
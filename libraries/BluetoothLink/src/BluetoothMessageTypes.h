@@ -0,0 +1,23 @@
+/*
+  BluetoothLink
+  Message types sent between the Uno and the Mega, the first line of every packet and the index
+  of its handler in the sketch's messageHandlers table, see BluetoothLink::setHandlers().
+
+  Kept here so both sketches, and every .ino file of a sketch whatever its place in the join
+  order, use the same numbers. A new type takes the next number and numMessageTypes goes up.
+
+  Before the handler table the cans errors were sent with the first line INT. A device still
+  running that firmware sends and expects INT; receivedUnknownMessage() in the sketches passes
+  such a packet to receivedCansError(), but an old device drops packets of type 0, so both
+  devices need the new firmware for the Uno's orders to be received.
+*/
+
+#ifndef BluetoothMessageTypes_h
+#define BluetoothMessageTypes_h
+
+#define MESSAGE_CANS_ERROR      0     // cans still to be picked up of each colour, red, green, blue
+#define numMessageTypes         1
+
+#define LEGACY_CANS_ERROR       "INT" // first line of MESSAGE_CANS_ERROR before the handler table
+
+#endif